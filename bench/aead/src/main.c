@@ -0,0 +1,137 @@
+/*
+ * AEAD benchmark: encrypts payloads of several sizes with the algorithm
+ * picked by CONFIG_SENSOR_AEAD_*, the same way the TX path does (in place,
+ * through src/aead.c), and prints one CSV line per payload size and mode:
+ *
+ *   aead,<alg>,<mode>,<bytes>,<cyc_per_byte>,<stack>,<ram>
+ *
+ * mode is "whole" (IV | CT | Tag) or "framed" (CONFIG_BENCH_AEAD_FRAME_SIZE
+ * frames). cyc_per_byte has two decimals and counts ticks of the clock named
+ * on the header line: CPU cycles on hardware, host nanoseconds on native_sim
+ * (the simulated clock does not advance while code runs). stack is the peak
+ * stack use of a run, setup included; ram is the per-payload state kept
+ * between chunks (struct aead_stream, PSA operation included).
+ */
+#include <zephyr/kernel.h>
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "aead.h"
+#include "bench.h"
+
+static const size_t sizes[] = { 16, 64, 256, 1024, 2048 };
+
+static struct {
+    psa_key_id_t key_id;
+    uint8_t  iv[AEAD_IV_SIZE];
+    uint64_t ctr;             // IV counter, bumped per payload
+    struct aead_stream s;
+    uint8_t  buf[4096];       // payload, frame overhead included
+
+    // Current run: input, then results
+    size_t   len;
+    bool     framed;
+    uint64_t ticks;
+    psa_status_t status;
+} B;
+
+// Encrypt one payload of B.len bytes; only setup and sealing are timed.
+static psa_status_t encrypt_once(void)
+{
+    size_t frame = CONFIG_BENCH_AEAD_FRAME_SIZE;
+    size_t pt_off = B.framed ? aead_frames_offset(sizeof(B.buf), frame) : AEAD_IV_SIZE;
+    size_t total = B.framed ? aead_frames_len(B.len, frame) : AEAD_IV_SIZE + B.len + AEAD_TAG_SIZE;
+    psa_status_t status;
+    bench_stamp_t t0, t1;
+
+    if (pt_off + B.len > sizeof(B.buf) || total > sizeof(B.buf)) {
+        return PSA_ERROR_INSUFFICIENT_MEMORY;
+    }
+    for (size_t i = 0; i < B.len; i++) {
+        B.buf[pt_off + i] = (uint8_t)(i * 7);
+    }
+    sys_put_be64(B.ctr, &B.iv[AEAD_IV_SIZE - 8]);
+    B.ctr += B.framed ? aead_frames_count(B.len, frame) : 1;
+
+    t0 = bench_stamp();
+    if (B.framed) {
+        status = aead_frames_begin(&B.s, B.key_id, B.iv, B.buf, pt_off, B.len, frame);
+    } else {
+        status = aead_stream_begin(&B.s, B.key_id, B.iv, B.buf, B.len);
+    }
+    if (status == PSA_SUCCESS) {
+        status = aead_stream_seal(&B.s, total);
+    }
+    t1 = bench_stamp();
+
+    B.ticks += bench_elapsed(&t0, &t1);
+    return status;
+}
+
+static void run_entry(void *arg)
+{
+    ARG_UNUSED(arg);
+
+    B.ticks = 0;
+    B.status = PSA_SUCCESS;
+    for (int i = 0; i < CONFIG_BENCH_AEAD_ITERATIONS && B.status == PSA_SUCCESS; i++) {
+        B.status = encrypt_once();
+    }
+}
+
+// One size and mode on a freshly painted stack, then one CSV line.
+static void run(size_t len, bool framed)
+{
+    uint64_t bytes = (uint64_t)len * CONFIG_BENCH_AEAD_ITERATIONS;
+    uint64_t cpb100;
+    size_t stack;
+
+    B.len = len;
+    B.framed = framed;
+    stack = bench_run(run_entry, NULL);
+
+    if (B.status != PSA_SUCCESS) {
+        printf("# %s %u bytes failed: %d\n", framed ? "framed" : "whole",
+               (unsigned)len, (int)B.status);
+        return;
+    }
+
+    cpb100 = bench_per_byte_x100(B.ticks, bytes);
+    printf("aead,%s,%s,%u,%llu.%02u,%u,%u\n", AEAD_NAME, framed ? "framed" : "whole",
+           (unsigned)len, (unsigned long long)(cpb100 / 100), (unsigned)(cpb100 % 100),
+           (unsigned)stack,
+           (unsigned)sizeof(struct aead_stream));
+}
+
+int main(void)
+{
+    // Key bytes do not change the timing
+    static const uint8_t key[AEAD_KEY_SIZE];
+    psa_status_t status;
+
+    bench_clock_init();
+
+    status = psa_crypto_init();
+    if (status == PSA_SUCCESS) {
+        status = aead_import_key(key, &B.key_id);
+    }
+    if (status != PSA_SUCCESS) {
+        printf("# crypto setup failed: %d\n", (int)status);
+        return 0;
+    }
+
+    printf("# aead bench: %s, %d runs per size, clock_hz=%llu\n", AEAD_NAME,
+           CONFIG_BENCH_AEAD_ITERATIONS, (unsigned long long)bench_clock_hz());
+    printf("bench,alg,mode,bytes,cyc_per_byte,stack,ram\n");
+
+    for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+        run(sizes[i], false);
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+        run(sizes[i], true);
+    }
+
+    printf("bench aead done\n");
+    return 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * Shared benchmark support, see bench.h.
+ */
+#include <zephyr/kernel.h>
+#include <string.h>
+#include <zephyr/timing/timing.h>
+#include <zephyr/sys/sys_heap.h>
+#if defined(CONFIG_MBEDTLS)
+#include <mbedtls/platform.h>
+#endif
+
+#include "bench.h"
+
+#if defined(MBEDTLS_PLATFORM_MEMORY) && !defined(MBEDTLS_PLATFORM_CALLOC_MACRO)
+#define BENCH_COUNT_ALLOCS 1
+#endif
+
+K_THREAD_STACK_DEFINE(bench_stack, CONFIG_BENCH_STACK_SIZE);
+static struct k_thread bench_thread;
+
+#if defined(BENCH_COUNT_ALLOCS)
+K_HEAP_DEFINE(bench_heap, CONFIG_BENCH_HEAP_SIZE);
+static atomic_t bench_alloc_count;
+
+static void *bench_calloc(size_t n, size_t size)
+{
+    void *p;
+
+    if (size && n > SIZE_MAX / size) {
+        return NULL;
+    }
+    p = k_heap_alloc(&bench_heap, n * size, K_NO_WAIT);
+    if (p) {
+        memset(p, 0, n * size);
+        atomic_inc(&bench_alloc_count);
+    }
+    return p;
+}
+
+static void bench_free(void *p)
+{
+    if (p) {
+        k_heap_free(&bench_heap, p);
+    }
+}
+#endif
+
+void bench_allocs_init(void)
+{
+#if defined(BENCH_COUNT_ALLOCS)
+    mbedtls_platform_set_calloc_free(bench_calloc, bench_free);
+#endif
+}
+
+void bench_allocs_reset(void)
+{
+#if defined(BENCH_COUNT_ALLOCS)
+    atomic_set(&bench_alloc_count, 0);
+    (void)sys_heap_runtime_stats_reset_max(&bench_heap.heap);
+#endif
+}
+
+int32_t bench_allocs(void)
+{
+#if defined(BENCH_COUNT_ALLOCS)
+    return atomic_get(&bench_alloc_count);
+#else
+    return -1;
+#endif
+}
+
+size_t bench_heap_peak(void)
+{
+#if defined(BENCH_COUNT_ALLOCS)
+    struct sys_memory_stats stats;
+
+    if (sys_heap_runtime_stats_get(&bench_heap.heap, &stats) == 0) {
+        return stats.max_allocated_bytes;
+    }
+#endif
+    return 0;
+}
+
+void bench_clock_init(void)
+{
+#if !defined(CONFIG_ARCH_POSIX)
+    timing_init();
+    timing_start();
+#endif
+}
+
+static void bench_entry(void *p1, void *p2, void *p3)
+{
+    void (*fn)(void *arg) = p1;
+
+    ARG_UNUSED(p3);
+    fn(p2);
+}
+
+size_t bench_run(void (*fn)(void *arg), void *arg)
+{
+    size_t unused = 0;
+
+    // The stack is painted again at thread creation (CONFIG_INIT_STACKS)
+    k_thread_create(&bench_thread, bench_stack, K_THREAD_STACK_SIZEOF(bench_stack),
+                    bench_entry, fn, arg, NULL, K_PRIO_PREEMPT(1), 0, K_NO_WAIT);
+    k_thread_join(&bench_thread, K_FOREVER);
+    (void)k_thread_stack_space_get(&bench_thread, &unused);
+    return K_THREAD_STACK_SIZEOF(bench_stack) - unused;
+}
@@ -0,0 +1,14 @@
+#
+# Shared benchmark support (bench.h): the run clock and the painted-stack
+# runner. Included by each benchmark's CMakeLists.txt.
+#
+target_sources(app PRIVATE ${CMAKE_CURRENT_LIST_DIR}/bench.c)
+target_include_directories(app PRIVATE ${CMAKE_CURRENT_LIST_DIR} ${CMAKE_CURRENT_LIST_DIR}/../../src)
+
+# native_sim: the simulated clock stands still while code runs, so time
+# is read from the host (bench_clock_bottom.c is built into the runner).
+if(CONFIG_NATIVE_LIBRARY)
+  target_sources(native_simulator INTERFACE ${CMAKE_CURRENT_LIST_DIR}/bench_clock_bottom.c)
+elseif(CONFIG_ARCH_POSIX)
+  target_sources(app PRIVATE ${CMAKE_CURRENT_LIST_DIR}/bench_clock_bottom.c)
+endif()
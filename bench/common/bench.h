@@ -0,0 +1,79 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/timing/timing.h>
+
+/*
+ * Shared benchmark support. Runs are timed with a clock that counts CPU
+ * cycles on hardware and host nanoseconds on native_sim (the simulated
+ * clock does not advance while code runs); bench_clock_hz() names its
+ * rate. Each run executes on a freshly painted stack so its peak stack
+ * use can be reported.
+ */
+#if defined(CONFIG_ARCH_POSIX)
+// Host monotonic clock (bench_clock_bottom.c)
+uint64_t bench_host_ns(void);
+
+typedef uint64_t bench_stamp_t;
+
+static inline bench_stamp_t bench_stamp(void)
+{
+    return bench_host_ns();
+}
+
+static inline uint64_t bench_elapsed(bench_stamp_t *t0, bench_stamp_t *t1)
+{
+    return *t1 - *t0;
+}
+
+static inline uint64_t bench_clock_hz(void)
+{
+    return 1000000000ull;
+}
+#else
+typedef timing_t bench_stamp_t;
+
+static inline bench_stamp_t bench_stamp(void)
+{
+    return timing_counter_get();
+}
+
+static inline uint64_t bench_elapsed(bench_stamp_t *t0, bench_stamp_t *t1)
+{
+    return timing_cycles_get(t0, t1);
+}
+
+static inline uint64_t bench_clock_hz(void)
+{
+    return timing_freq_get();
+}
+#endif
+
+// Start the clock (the timing API on hardware).
+void bench_clock_init(void);
+
+// Run fn(arg) to completion on a freshly painted stack of
+// CONFIG_BENCH_STACK_SIZE bytes; returns the peak stack it used.
+size_t bench_run(void (*fn)(void *arg), void *arg);
+
+// Allocation accounting: with mbedTLS platform memory hooks available,
+// PSA allocations go through a counting heap of CONFIG_BENCH_HEAP_SIZE
+// bytes. The application itself never allocates. Call bench_allocs_init()
+// before psa_crypto_init().
+void bench_allocs_init(void);
+void bench_allocs_reset(void);
+// Allocations since the last reset, -1 if they cannot be counted.
+int32_t bench_allocs(void);
+// Peak heap bytes in use since the last reset.
+size_t bench_heap_peak(void);
+
+// Clock ticks per byte, times 100 (printed as "%llu.%02u").
+static inline uint64_t bench_per_byte_x100(uint64_t ticks, uint64_t bytes)
+{
+    return bytes ? ticks * 100 / bytes : 0;
+}
+
+#endif // BENCH_H
@@ -0,0 +1,340 @@
+/*
+ * Data path benchmark: times each stage of the sensor's TX path on its
+ * own, with the application's code, and prints one CSV line per stage,
+ * variant and size:
+ *
+ *   datapath,<stage>,<variant>,<bytes>,<cyc_per_byte>,<allocs>,<heap>,<stack>
+ *
+ * Stages:
+ *   prepare  what sensor_prepare_payload() does to a payload taken from
+ *            the sensor log: payload_encode() (variant = codec, with the
+ *            raw fallback) and a one-stream seal with the
+ *            CONFIG_SENSOR_AEAD_* algorithm, as payload_fill() does when
+ *            staging. bytes = raw log bytes the payload holds.
+ *   encrypt  encrypt_character_array() (src/aes_gcm.c), one-shot AES-GCM
+ *            with its own key import. bytes = plaintext.
+ *   chunk    cutting a payload into WSTART notifications (src/chunk.h),
+ *            each header patched in front of its chunk in place, as
+ *            nus_send_framed() does; variant = ATT MTU. bytes = payload.
+ *   cmd      mule command parsing (src/cmd_parse.c), a fixed mix of text
+ *            or binary commands. bytes = command bytes.
+ *
+ * cyc_per_byte has two decimals and counts ticks of the clock named on the
+ * header line: CPU cycles on hardware, host nanoseconds on native_sim.
+ * allocs counts heap allocations per run (-1: not countable in this
+ * build), heap is the peak heap use and stack the peak stack use of a run.
+ */
+#include <zephyr/kernel.h>
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "data.h"
+#include "aead.h"
+#include "aes_gcm.h"
+#include "chunk.h"
+#include "cmd_parse.h"
+#include "payload.h"
+#include "bench.h"
+
+#define PAYLOAD_MAX 2048
+
+static const size_t sizes[] = { 256, 1024, 2048 };
+
+// Codec variants of the prepare stage
+enum prep_codec {
+    PREP_RAW,             // comp_hdr_t + raw records (CODEC_NONE)
+    PREP_LZSS,
+    PREP_DELTA_LZSS,
+    PREP_RECORDS,
+};
+
+static const char *const prep_name[] = {
+    [PREP_RAW]        = "raw",
+    [PREP_LZSS]       = "lzss",
+    [PREP_DELTA_LZSS] = "delta_lzss",
+    [PREP_RECORDS]    = "records",
+};
+
+// Text commands parsed by the cmd stage, a mule's usual mix
+static const char *const text_cmds[] = {
+    "WSTART 16",
+    "ACK 1234",
+    "NACK 3 5 9 12",
+    "STATUS",
+    "RESUME 1a2b3c4d 4096 16",
+    "SYNC 100000 8",
+};
+
+// Stage being run; results are filled in by the run
+struct run {
+    void   (*fn)(struct run *r);
+    size_t   len;         // stage input size
+    int      variant;
+    uint64_t ticks;
+    uint64_t bytes;       // bytes processed, for the per-byte cost
+    int      err;
+};
+
+static struct {
+    // Synthetic sensor log, as log_store_read() would return it
+    sample_rec_t log[PAYLOAD_MAX / sizeof(sample_rec_t)];
+    size_t   log_pos;
+    size_t   log_end;
+
+    psa_key_id_t key_id;
+    uint64_t ctr;         // IV counter, bumped per payload
+    struct aead_stream s;
+    uint8_t  iv[AEAD_IV_SIZE];
+    // Room for a chunk header in front of chunk 0, as in payload_buf
+    uint8_t  headroom[sizeof(chunk_hdr_t)];
+    uint8_t  payload[PAYLOAD_MAX + AEAD_IV_SIZE + AEAD_TAG_SIZE];
+    uint8_t  pt[PAYLOAD_MAX];
+    uint8_t  cmds[ARRAY_SIZE(text_cmds)][2 + 32];
+    size_t   cmd_len[ARRAY_SIZE(text_cmds)];
+} B;
+
+BUILD_ASSERT(offsetof(__typeof__(B), payload) ==
+             offsetof(__typeof__(B), headroom) + sizeof(chunk_hdr_t),
+             "headroom must sit right before payload");
+
+// Two streams sampled once a second, slowly drifting: close to what the
+// sampler stores, so the codecs see realistic input.
+static void log_fill(void)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(B.log); i++) {
+        B.log[i] = (sample_rec_t){
+            .t_ms   = 1000 * (uint32_t)(i / 2),
+            .stream = i & 1,
+            .type   = (i & 1) ? REC_T_U16 : REC_T_CENTI,
+            .value  = (i & 1) ? 1013 + (int16_t)(i % 7) : 2150 + (int16_t)(i % 23),
+        };
+    }
+}
+
+static int log_read(void *arg, uint8_t *dst, size_t len)
+{
+    const uint8_t *log = (const uint8_t *)B.log;
+    size_t n = MIN(len, B.log_end - B.log_pos);
+
+    ARG_UNUSED(arg);
+    memcpy(dst, &log[B.log_pos], n);
+    B.log_pos += n;
+    return n;
+}
+
+static void log_rewind(void *arg)
+{
+    ARG_UNUSED(arg);
+    B.log_pos = 0;
+}
+
+// Encode r->len bytes of log into the payload and seal it, with the code
+// payload_fill() uses. Returns the raw bytes it holds, or -errno.
+static int prepare_once(struct run *r)
+{
+    static const uint8_t codecs[] = {
+        [PREP_RAW]        = CODEC_NONE,
+        [PREP_LZSS]       = CODEC_LZSS,
+        [PREP_DELTA_LZSS] = CODEC_DELTA_LZSS,
+        [PREP_RECORDS]    = CODEC_RECORDS,
+    };
+    const struct payload_codec codec = {
+        .codec   = codecs[r->variant],
+        .framed  = true,
+        .rec_pkt = 240,
+    };
+    const struct payload_src src = { .read = log_read, .rewind = log_rewind };
+    size_t pt_off = aead_payload_pt_off(sizeof(B.payload), 0);
+    struct payload_enc enc;
+    psa_status_t status;
+    int err;
+
+    B.log_pos = 0;
+    B.log_end = r->len;
+
+    err = payload_encode(&src, &codec, &B.payload[pt_off],
+                         aead_payload_pt_max(sizeof(B.payload), 0), &enc);
+    if (err) {
+        return err;
+    }
+
+    sys_put_be64(B.ctr++, &B.iv[AEAD_IV_SIZE - 8]);
+    status = aead_payload_begin(&B.s, B.key_id, B.iv, B.payload, sizeof(B.payload), enc.len, 0);
+    if (status == PSA_SUCCESS) {
+        status = aead_stream_seal(&B.s, aead_payload_len(enc.len, 0));
+    }
+    return (status == PSA_SUCCESS) ? (int)enc.raw_len : -EIO;
+}
+
+static void stage_prepare(struct run *r)
+{
+    for (int i = 0; i < CONFIG_BENCH_DATAPATH_ITERATIONS; i++) {
+        bench_stamp_t t0 = bench_stamp();
+        int n = prepare_once(r);
+        bench_stamp_t t1 = bench_stamp();
+
+        if (n < 0) {
+            r->err = n;
+            return;
+        }
+        r->ticks += bench_elapsed(&t0, &t1);
+        r->bytes += n;
+    }
+}
+
+static void stage_encrypt(struct run *r)
+{
+    // Key and IV bytes do not change the timing
+    static const uint8_t key[AES_GCM_KEY_SIZE];
+    static const uint8_t iv[AES_GCM_IV_SIZE];
+
+    memset(B.pt, 0x5a, r->len);
+    for (int i = 0; i < CONFIG_BENCH_DATAPATH_ITERATIONS; i++) {
+        bench_stamp_t t0 = bench_stamp();
+
+        encrypt_character_array(key, iv, B.pt, B.payload, r->len);
+
+        bench_stamp_t t1 = bench_stamp();
+
+        r->ticks += bench_elapsed(&t0, &t1);
+        r->bytes += r->len;
+    }
+}
+
+// The windowed TX path per notification, as nus_send_framed() does it:
+// chunk bounds, then the header patched in place over the bytes in front
+// of the chunk and put back once sent. variant is the ATT MTU.
+static void stage_chunk(struct run *r)
+{
+    size_t room = (size_t)r->variant - 3 - sizeof(chunk_hdr_t);
+    uint16_t total = chunk_count(r->len, room);
+    volatile size_t sink = 0;
+
+    for (int i = 0; i < CONFIG_BENCH_DATAPATH_ITERATIONS; i++) {
+        bench_stamp_t t0 = bench_stamp();
+
+        for (uint16_t seq = 0; seq < total; seq++) {
+            uint8_t *src = (uint8_t *)&B + offsetof(__typeof__(B), payload) +
+                           chunk_off(0, room, seq);
+            uint8_t *hdr = src - sizeof(chunk_hdr_t);
+            uint8_t saved[sizeof(chunk_hdr_t)];
+
+            memcpy(saved, hdr, sizeof(saved));
+            chunk_hdr_put(hdr, seq, total);
+            // Stands in for the notification the stack copies
+            sink += hdr[0] + chunk_len(0, r->len, room, seq);
+            memcpy(hdr, saved, sizeof(saved));
+        }
+
+        bench_stamp_t t1 = bench_stamp();
+
+        r->ticks += bench_elapsed(&t0, &t1);
+        r->bytes += r->len;
+    }
+    ARG_UNUSED(sink);
+}
+
+// variant 0: text commands to binary; 1: binary commands looked up
+static void stage_cmd(struct run *r)
+{
+    volatile size_t sink = 0;
+
+    for (int i = 0; i < CONFIG_BENCH_DATAPATH_ITERATIONS; i++) {
+        bench_stamp_t t0 = bench_stamp();
+
+        for (size_t c = 0; c < ARRAY_SIZE(text_cmds); c++) {
+            if (r->variant == 0) {
+                sink += cmd_from_text((const uint8_t *)text_cmds[c], strlen(text_cmds[c]),
+                                      B.cmds[c], sizeof(B.cmds[c]));
+            } else {
+                const struct cmd_syntax *syn = cmd_syntax_of(B.cmds[c][0]);
+
+                sink += (syn && B.cmds[c][1] >= syn->min_len);
+            }
+        }
+
+        bench_stamp_t t1 = bench_stamp();
+
+        r->ticks += bench_elapsed(&t0, &t1);
+        for (size_t c = 0; c < ARRAY_SIZE(text_cmds); c++) {
+            r->bytes += r->variant == 0 ? strlen(text_cmds[c]) : B.cmd_len[c];
+        }
+    }
+    ARG_UNUSED(sink);
+}
+
+static void run_entry(void *arg)
+{
+    struct run *r = arg;
+
+    r->fn(r);
+}
+
+// One stage, variant and size on a freshly painted stack, then one CSV line.
+static void run(const char *stage, const char *variant, void (*fn)(struct run *r),
+                int v, size_t len)
+{
+    struct run r = { .fn = fn, .len = len, .variant = v };
+    uint64_t cpb100;
+    size_t stack;
+
+    bench_allocs_reset();
+    stack = bench_run(run_entry, &r);
+
+    if (r.err || r.bytes == 0) {
+        printf("# %s %s %u bytes failed: %d\n", stage, variant, (unsigned)len, r.err);
+        return;
+    }
+
+    cpb100 = bench_per_byte_x100(r.ticks, r.bytes);
+    printf("datapath,%s,%s,%u,%llu.%02u,%d,%u,%u\n", stage, variant,
+           (unsigned)(r.bytes / CONFIG_BENCH_DATAPATH_ITERATIONS),
+           (unsigned long long)(cpb100 / 100), (unsigned)(cpb100 % 100),
+           (int)bench_allocs(), (unsigned)bench_heap_peak(), (unsigned)stack);
+}
+
+int main(void)
+{
+    static const uint8_t key[AEAD_KEY_SIZE];
+    psa_status_t status;
+
+    bench_clock_init();
+    bench_allocs_init();
+
+    status = psa_crypto_init();
+    if (status == PSA_SUCCESS) {
+        status = aead_import_key(key, &B.key_id);
+    }
+    if (status != PSA_SUCCESS) {
+        printf("# crypto setup failed: %d\n", (int)status);
+        return 0;
+    }
+    log_fill();
+    for (size_t c = 0; c < ARRAY_SIZE(text_cmds); c++) {
+        B.cmd_len[c] = cmd_from_text((const uint8_t *)text_cmds[c], strlen(text_cmds[c]),
+                                     B.cmds[c], sizeof(B.cmds[c]));
+    }
+
+    printf("# datapath bench: %s, %d runs each, clock_hz=%llu\n", AEAD_NAME,
+           CONFIG_BENCH_DATAPATH_ITERATIONS, (unsigned long long)bench_clock_hz());
+    printf("bench,stage,variant,bytes,cyc_per_byte,allocs,heap,stack\n");
+
+    for (size_t c = 0; c < ARRAY_SIZE(prep_name); c++) {
+        for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+            run("prepare", prep_name[c], stage_prepare, c, sizes[i]);
+        }
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+        run("encrypt", "aes_gcm", stage_encrypt, 0, sizes[i]);
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+        run("chunk", "23", stage_chunk, 23, sizes[i]);
+        run("chunk", "247", stage_chunk, 247, sizes[i]);
+    }
+    run("cmd", "text", stage_cmd, 0, 0);
+    run("cmd", "binary", stage_cmd, 1, 0);
+
+    printf("bench datapath done\n");
+    return 0;
+}
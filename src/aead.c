@@ -0,0 +1,310 @@
+/*
+ * Payload AEAD on the PSA multipart API: whole payloads streamed chunk by
+ * chunk, or cut into frames sealed one by one (see aead.h). The algorithm
+ * is fixed at build time by AEAD_ALG.
+ */
+#include "aead.h"
+#include <psa/crypto.h>
+#include <string.h>
+
+// Framed payloads: truncated tags where the algorithm has them
+#if AEAD_SEG_TAG_SIZE < AEAD_TAG_SIZE
+#define AEAD_SEG_ALG  PSA_ALG_AEAD_WITH_SHORTENED_TAG(AEAD_ALG, AEAD_SEG_TAG_SIZE)
+#else
+#define AEAD_SEG_ALG  AEAD_ALG
+#endif
+
+psa_status_t aead_import_key(const uint8_t key[AEAD_KEY_SIZE], psa_key_id_t *key_id)
+{
+    psa_key_attributes_t attr = PSA_KEY_ATTRIBUTES_INIT;
+
+    // Volatile key: lives until it is destroyed or the device resets
+    psa_set_key_type(&attr, AEAD_KEY_TYPE);
+    psa_set_key_bits(&attr, AEAD_KEY_SIZE * 8);
+    psa_set_key_usage_flags(&attr, PSA_KEY_USAGE_ENCRYPT);
+    psa_set_key_algorithm(&attr, PSA_ALG_AEAD_WITH_AT_LEAST_THIS_LENGTH_TAG(AEAD_ALG,
+                                                                            AEAD_SEG_TAG_SIZE));
+    return psa_import_key(&attr, key, AEAD_KEY_SIZE, key_id);
+}
+
+// ---- Streaming encryption ----
+// Plaintext is fed to PSA in steps of this many bytes; the ciphertext goes
+// through a stack buffer of one step plus one block, because PSA may hold
+// back a partial block and so write output that lags its input.
+#define AEAD_STREAM_STEP   64
+#define AEAD_BLOCK_SIZE    16
+
+psa_status_t aead_stream_begin(struct aead_stream *s, psa_key_id_t key_id, const uint8_t *iv, uint8_t *payload, size_t length)
+{
+    psa_status_t status;
+
+    aead_stream_abort(s);
+
+    s->op = (psa_aead_operation_t)PSA_AEAD_OPERATION_INIT;
+    status = psa_aead_encrypt_setup(&s->op, key_id, AEAD_ALG);
+    // CCM needs the lengths up front; the others take them as a check
+    if (status == PSA_SUCCESS) {
+        status = psa_aead_set_lengths(&s->op, 0, length);
+    }
+    if (status == PSA_SUCCESS) {
+        status = psa_aead_set_nonce(&s->op, iv, AEAD_IV_SIZE);
+    }
+    if (status != PSA_SUCCESS) {
+        (void) psa_aead_abort(&s->op);
+        return status;
+    }
+
+    memcpy(payload, iv, AEAD_IV_SIZE);
+    s->payload = payload;
+    s->length  = length;
+    s->in      = 0;
+    s->out     = 0;
+    s->frame   = 0;
+    s->active  = true;
+    return PSA_SUCCESS;
+}
+
+// Feed the next step of plaintext, or finish once all of it is in.
+static psa_status_t stream_step(struct aead_stream *s)
+{
+    uint8_t ct[AEAD_STREAM_STEP + AEAD_BLOCK_SIZE];
+    uint8_t *pt = s->payload + AEAD_IV_SIZE;
+    size_t n = s->length - s->in;
+    size_t ct_len = 0;
+    size_t tag_len = 0;
+    psa_status_t status;
+
+    if (n > 0) {
+        if (n > AEAD_STREAM_STEP) {
+            n = AEAD_STREAM_STEP;
+        }
+        status = psa_aead_update(&s->op, pt + s->in, n, ct, sizeof(ct), &ct_len);
+        s->in += n;
+    } else {
+        status = psa_aead_finish(&s->op, ct, sizeof(ct), &ct_len,
+                                 pt + s->length, AEAD_TAG_SIZE, &tag_len);
+    }
+    if (status != PSA_SUCCESS) {
+        aead_stream_abort(s);
+        return status;
+    }
+
+    // Output never runs ahead of input, so this only overwrites plaintext
+    // that PSA has already consumed.
+    memcpy(pt + s->out, ct, ct_len);
+    s->out += ct_len;
+
+    if (n == 0) {
+        s->active = false;
+    }
+    return PSA_SUCCESS;
+}
+
+static psa_status_t seal_frame(struct aead_stream *s);
+
+psa_status_t aead_stream_seal(struct aead_stream *s, size_t upto)
+{
+    psa_status_t status;
+
+    if (s->frame) {
+        while (s->active && s->out < upto) {
+            status = seal_frame(s);
+            if (status != PSA_SUCCESS) {
+                return status;
+            }
+        }
+        return (s->active || s->index == s->total) ? PSA_SUCCESS : PSA_ERROR_BAD_STATE;
+    }
+
+    while (s->active && AEAD_IV_SIZE + s->out < upto) {
+        status = stream_step(s);
+        if (status != PSA_SUCCESS) {
+            return status;
+        }
+    }
+
+    // Finished streams are sealed to the end, tag included
+    if (!s->active && s->out < s->length) {
+        return PSA_ERROR_BAD_STATE;
+    }
+    return PSA_SUCCESS;
+}
+
+void aead_stream_abort(struct aead_stream *s)
+{
+    if (s->active) {
+        // Framed streams only hold an operation while sealing a frame
+        if (!s->frame) {
+            (void) psa_aead_abort(&s->op);
+        }
+        s->active = false;
+    }
+}
+
+// ---- Framed encryption ----
+#define AEAD_SEG_OVERHEAD  (AEAD_SEG_HDR_SIZE + AEAD_SEG_TAG_SIZE)
+
+size_t aead_frames_count(size_t length, size_t frame)
+{
+    size_t first = frame - AEAD_SEG_OVERHEAD - AEAD_IV_SIZE;
+    size_t rest  = frame - AEAD_SEG_OVERHEAD;
+
+    if (length <= first) {
+        return 1;
+    }
+    return 1 + (length - first + rest - 1) / rest;
+}
+
+size_t aead_frames_len(size_t length, size_t frame)
+{
+    return AEAD_IV_SIZE + aead_frames_count(length, frame) * AEAD_SEG_OVERHEAD + length;
+}
+
+size_t aead_frames_offset(size_t cap, size_t frame)
+{
+    // Frame overhead never shrinks as plaintext grows, so the overhead of
+    // a whole buffer of plaintext covers whatever actually fits.
+    return aead_frames_len(cap, frame) - cap;
+}
+
+psa_status_t aead_frames_begin(struct aead_stream *s, psa_key_id_t key_id, const uint8_t *iv, uint8_t *payload, size_t pt_off, size_t length, size_t frame)
+{
+    size_t total;
+
+    aead_stream_abort(s);
+
+    if (frame <= AEAD_SEG_OVERHEAD + AEAD_IV_SIZE) {
+        return PSA_ERROR_INVALID_ARGUMENT;
+    }
+    total = aead_frames_count(length, frame);
+    if (total > UINT16_MAX || pt_off < aead_frames_len(length, frame) - length) {
+        return PSA_ERROR_INVALID_ARGUMENT;
+    }
+
+    memcpy(s->iv, iv, AEAD_IV_SIZE);
+    s->key_id  = key_id;
+    s->payload = payload;
+    s->pt_off  = pt_off;
+    s->length  = length;
+    s->frame   = frame;
+    s->in      = 0;
+    s->out     = 0;
+    s->index   = 0;
+    s->total   = (uint16_t)total;
+    s->active  = true;
+    return PSA_SUCCESS;
+}
+
+size_t aead_payload_pt_off(size_t cap, size_t frame)
+{
+    return frame ? aead_frames_offset(cap, frame) : AEAD_IV_SIZE;
+}
+
+size_t aead_payload_pt_max(size_t cap, size_t frame)
+{
+    return cap - aead_payload_pt_off(cap, frame) - (frame ? 0 : AEAD_TAG_SIZE);
+}
+
+size_t aead_payload_len(size_t length, size_t frame)
+{
+    return frame ? aead_frames_len(length, frame) : AEAD_IV_SIZE + length + AEAD_TAG_SIZE;
+}
+
+size_t aead_payload_nonces(size_t length, size_t frame)
+{
+    return frame ? aead_frames_count(length, frame) : 1;
+}
+
+psa_status_t aead_payload_begin(struct aead_stream *s, psa_key_id_t key_id, const uint8_t *iv, uint8_t *payload, size_t cap, size_t length, size_t frame)
+{
+    if (frame) {
+        return aead_frames_begin(s, key_id, iv, payload, aead_frames_offset(cap, frame),
+                                 length, frame);
+    }
+    return aead_stream_begin(s, key_id, iv, payload, length);
+}
+
+// Nonce of frame i: base IV with i added to its big-endian counter part
+static void frame_nonce(const struct aead_stream *s, uint16_t i, uint8_t *nonce)
+{
+    unsigned carry = i;
+
+    memcpy(nonce, s->iv, AEAD_IV_SIZE);
+    for (int b = AEAD_IV_SIZE - 1; b >= AEAD_IV_SIZE - 8 && carry; b--) {
+        carry += nonce[b];
+        nonce[b] = (uint8_t)carry;
+        carry >>= 8;
+    }
+}
+
+// Seal the next frame: header, its share of the plaintext, truncated tag.
+static psa_status_t seal_frame(struct aead_stream *s)
+{
+    uint8_t ct[AEAD_STREAM_STEP + AEAD_BLOCK_SIZE];
+    uint8_t tag[AEAD_SEG_TAG_SIZE];
+    uint8_t nonce[AEAD_IV_SIZE];
+    uint8_t *frame = s->payload + s->out;
+    const uint8_t *pt = s->payload + s->pt_off;
+    size_t ad_len = AEAD_SEG_HDR_SIZE + (s->index == 0 ? AEAD_IV_SIZE : 0);
+    size_t n = s->frame - ad_len - AEAD_SEG_TAG_SIZE;
+    size_t pos = s->out + ad_len;
+    size_t ct_len = 0;
+    size_t tag_len = 0;
+    psa_status_t status;
+
+    if (n > s->length - s->in) {
+        n = s->length - s->in;
+    }
+
+    // Header (and base IV) first: they only overwrite bytes already sealed
+    // or the gap left in front of the plaintext.
+    frame[0] = (uint8_t)s->index;
+    frame[1] = (uint8_t)(s->index >> 8);
+    frame[2] = (uint8_t)s->total;
+    frame[3] = (uint8_t)(s->total >> 8);
+    if (s->index == 0) {
+        memcpy(frame + AEAD_SEG_HDR_SIZE, s->iv, AEAD_IV_SIZE);
+    }
+    frame_nonce(s, s->index, nonce);
+
+    s->op = (psa_aead_operation_t)PSA_AEAD_OPERATION_INIT;
+    status = psa_aead_encrypt_setup(&s->op, s->key_id, AEAD_SEG_ALG);
+    if (status == PSA_SUCCESS) {
+        status = psa_aead_set_lengths(&s->op, ad_len, n);
+    }
+    if (status == PSA_SUCCESS) {
+        status = psa_aead_set_nonce(&s->op, nonce, sizeof(nonce));
+    }
+    if (status == PSA_SUCCESS) {
+        status = psa_aead_update_ad(&s->op, frame, ad_len);
+    }
+    while (status == PSA_SUCCESS && n > 0) {
+        size_t step = (n > AEAD_STREAM_STEP) ? AEAD_STREAM_STEP : n;
+
+        status = psa_aead_update(&s->op, pt + s->in, step, ct, sizeof(ct), &ct_len);
+        s->in += step;
+        n -= step;
+        if (status == PSA_SUCCESS) {
+            memcpy(s->payload + pos, ct, ct_len);
+            pos += ct_len;
+        }
+    }
+    if (status == PSA_SUCCESS) {
+        status = psa_aead_finish(&s->op, ct, sizeof(ct), &ct_len, tag, sizeof(tag), &tag_len);
+    }
+    if (status != PSA_SUCCESS) {
+        (void) psa_aead_abort(&s->op);
+        s->active = false;
+        return status;
+    }
+
+    memcpy(s->payload + pos, ct, ct_len);
+    pos += ct_len;
+    memcpy(s->payload + pos, tag, tag_len);
+    s->out = pos + tag_len;
+
+    if (++s->index == s->total) {
+        s->active = false;
+    }
+    return PSA_SUCCESS;
+}
@@ -0,0 +1,152 @@
+#ifndef AEAD_H
+#define AEAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <psa/crypto.h>
+
+/*
+ * Payload AEAD, one algorithm per build (CONFIG_SENSOR_AEAD_*):
+ *   AES-128-GCM        the default; accelerated where the crypto engine
+ *                      has AES (CRACEN on nRF54)
+ *   AES-128-CCM        AES without GHASH: two AES passes per block
+ *   ChaCha20-Poly1305  no AES at all, often cheapest in pure software
+ * All three take a 12-byte nonce and give a 16-byte tag, so payload
+ * layouts and nonce handling do not depend on the choice. Only the key
+ * size does, and Poly1305 tags cannot be truncated for framed payloads.
+ */
+#if defined(CONFIG_SENSOR_AEAD_CHACHA20_POLY1305)
+#define AEAD_ALG           PSA_ALG_CHACHA20_POLY1305
+#define AEAD_KEY_TYPE      PSA_KEY_TYPE_CHACHA20
+#define AEAD_KEY_SIZE      32
+#define AEAD_SEG_TAG_SIZE  16
+#define AEAD_NAME          "chacha20-poly1305"
+#elif defined(CONFIG_SENSOR_AEAD_AES_CCM)
+#define AEAD_ALG           PSA_ALG_CCM
+#define AEAD_KEY_TYPE      PSA_KEY_TYPE_AES
+#define AEAD_KEY_SIZE      16
+#define AEAD_SEG_TAG_SIZE  8
+#define AEAD_NAME          "aes-128-ccm"
+#else
+#define AEAD_ALG           PSA_ALG_GCM
+#define AEAD_KEY_TYPE      PSA_KEY_TYPE_AES
+#define AEAD_KEY_SIZE      16
+#define AEAD_SEG_TAG_SIZE  8
+#define AEAD_NAME          "aes-128-gcm"
+#endif
+
+#define AEAD_IV_SIZE       12
+#define AEAD_TAG_SIZE      16
+#define AEAD_SEG_HDR_SIZE  4
+
+// Import a volatile payload key allowed for both full and framed payloads.
+// Returns PSA_SUCCESS or the PSA error.
+psa_status_t aead_import_key(const uint8_t key[AEAD_KEY_SIZE], psa_key_id_t *key_id);
+
+/*
+ * Streaming encryption of one payload: [IV | Ciphertext | Tag]
+ * -----------------------------------------------------------
+ * aead_stream_begin() writes the IV in front and sets up a PSA multipart
+ * AEAD operation with an already imported key (see crypto_session.h); the
+ * plaintext stays where it is, at payload + IV.
+ * aead_stream_seal() then encrypts it in place, front to back, only as
+ * far as the caller is about to send, and appends the tag once the last
+ * byte is done. Stack use does not depend on the payload size.
+ * Failures return the PSA status and are left to the caller to report.
+ */
+struct aead_stream {
+    psa_aead_operation_t op;
+    uint8_t *payload;     // IV | plaintext, turning into IV | CT | Tag
+    size_t   length;      // plaintext bytes
+    size_t   in;          // plaintext bytes fed to PSA
+    size_t   out;         // ciphertext bytes written back
+    bool     active;      // operation set up and not finished
+
+    // Framed mode only (frame != 0, see aead_frames_begin())
+    size_t   frame;       // bytes per frame on air
+    size_t   pt_off;      // where the plaintext waits in payload
+    psa_key_id_t key_id;
+    uint8_t  iv[AEAD_IV_SIZE];
+    uint16_t index;       // next frame to seal
+    uint16_t total;
+};
+
+psa_status_t aead_stream_begin(struct aead_stream *s,
+                                  psa_key_id_t key_id,
+                                  const uint8_t *iv,
+                                  uint8_t *payload,
+                                  size_t length);
+
+/*
+ * Make payload[0, upto) final: IV, ciphertext and, once upto reaches the
+ * end, the tag. Bytes already sealed are left alone, so chunks may be
+ * resent or sent to several receivers.
+ */
+psa_status_t aead_stream_seal(struct aead_stream *s, size_t upto);
+
+// Drop an unfinished stream (e.g. the payload is replaced).
+void aead_stream_abort(struct aead_stream *s);
+
+/*
+ * Framed encryption: every frame sealed on its own
+ * -------------------------------------------------
+ * The payload is cut into frames of 'frame' bytes (the last one shorter):
+ *    [index:u16 | total:u16 | (frame 0 only: base IV) | CT | Tag]
+ * index and total are little-endian. Frame i is encrypted with the base
+ * IV whose last 8 bytes, read as a big-endian counter, are increased by i;
+ * its header (and the base IV, in frame 0) is authenticated data. The tag
+ * is truncated to AEAD_SEG_TAG_SIZE bytes where the algorithm allows it. A receiver can check each
+ * frame as soon as it arrives, and 'total' exposes a cut-off payload.
+ *
+ * Frames are longer than the plaintext they carry, so the plaintext must
+ * sit at aead_frames_offset() in the payload buffer. Sealing then
+ * writes the frames from the start of the buffer without ever reaching
+ * plaintext not yet read. aead_stream_seal() and _abort() work on
+ * framed streams too, a whole frame at a time.
+ */
+// Frames needed for 'length' bytes of plaintext (at least one)
+size_t aead_frames_count(size_t length, size_t frame);
+// Framed payload length for 'length' bytes of plaintext
+size_t aead_frames_len(size_t length, size_t frame);
+// Plaintext offset in a buffer of 'cap' bytes; cap minus this is the most
+// plaintext that fits
+size_t aead_frames_offset(size_t cap, size_t frame);
+
+/*
+ * Set up framed encryption of the 'length' plaintext bytes at
+ * payload + pt_off. 'iv' is the base IV; the caller must not use the
+ * aead_frames_count() nonces derived from it for anything else.
+ */
+psa_status_t aead_frames_begin(struct aead_stream *s,
+                                  psa_key_id_t key_id,
+                                  const uint8_t *iv,
+                                  uint8_t *payload,
+                                  size_t pt_off,
+                                  size_t length,
+                                  size_t frame);
+
+/*
+ * Either layout, picked by frame size as payload_fill() does: 0 for one
+ * stream with the plaintext at AEAD_IV_SIZE, else frames of 'frame' bytes
+ * with the plaintext at aead_frames_offset(). 'cap' is the size of the
+ * whole payload buffer.
+ */
+// Plaintext offset in the payload buffer
+size_t aead_payload_pt_off(size_t cap, size_t frame);
+// Most plaintext that fits there
+size_t aead_payload_pt_max(size_t cap, size_t frame);
+// Payload length for 'length' bytes of plaintext
+size_t aead_payload_len(size_t length, size_t frame);
+// Nonces the payload takes from its base IV
+size_t aead_payload_nonces(size_t length, size_t frame);
+// Set up encryption of the 'length' bytes at aead_payload_pt_off()
+psa_status_t aead_payload_begin(struct aead_stream *s,
+                                   psa_key_id_t key_id,
+                                   const uint8_t *iv,
+                                   uint8_t *payload,
+                                   size_t cap,
+                                   size_t length,
+                                   size_t frame);
+
+#endif // AEAD_H
@@ -17,12 +17,10 @@ void encrypt_character_array(const uint8_t *key, const uint8_t *iv, const uint8_
     psa_key_id_t key_id = 0;
     psa_key_attributes_t attr = PSA_KEY_ATTRIBUTES_INIT;
 
-    // make the ciphertext buffer
-    // PSA produces CT||TAG; we’ll prepend IV ourselves
-    uint8_t ct_and_tag[/* pt */ 0 + /* tag */ 0 + 1]; // placeholder to satisfy old compilers
-    // Use variable length array for exact ciphertext + tag size:
-    uint8_t ct_and_tag_vla[length + AES_GCM_TAG_SIZE];
-    uint8_t *ct_and_tag_ptr = ct_and_tag_vla;
+    // PSA writes CT||TAG straight into the payload, after room for the IV.
+    // plaintext may already sit there (in-place encryption), so no scratch
+    // buffer and no second copy of the ciphertext are needed.
+    uint8_t *ct_and_tag_ptr = payload + AES_GCM_IV_SIZE;
 
     size_t out_len = 0;
 
@@ -51,7 +49,7 @@ void encrypt_character_array(const uint8_t *key, const uint8_t *iv, const uint8_
                           NULL, 0,               // AAD ptr/len (not added)
                           plaintext, length,     // input
                           ct_and_tag_ptr,         // ptr to ciphertext buffer
-                          sizeof(ct_and_tag_vla), // size of ciphertext buffer
+                          length + AES_GCM_TAG_SIZE, // size of ciphertext buffer
                           &out_len); // size of output in the buffer
     if (status != PSA_SUCCESS) {
         printf("psa_aead_encrypt failed: %d\n", (int)status);
@@ -66,13 +64,10 @@ void encrypt_character_array(const uint8_t *key, const uint8_t *iv, const uint8_
         return;
     }
 
-    // 3) Create the payload with the structure: IV || Ciphertext || Authentication Tag
-    // Build payload = IV || CT || TAG
-    memcpy(payload,                              iv,               AES_GCM_IV_SIZE); // iv
-    memcpy(payload + AES_GCM_IV_SIZE,            ct_and_tag_ptr,   out_len);         // ciphertext and tag
+    // 3) Complete the payload structure: IV || Ciphertext || Authentication Tag
+    // CT||TAG are already in place; only the IV goes in front.
+    memcpy(payload, iv, AES_GCM_IV_SIZE); // iv
 
     // free
     (void) psa_destroy_key(key_id);
 }
-
-
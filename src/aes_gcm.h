@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <psa/crypto.h>
 
 /*
  * AES-GCM parameter constants
@@ -22,6 +23,10 @@
  *    [IV | Ciphertext | Tag]
  *
  * 'payload' must have space for AES_GCM_IV_SIZE + length + AES_GCM_TAG_SIZE bytes.
+ * Encryption may run in place: 'plaintext' may be payload + AES_GCM_IV_SIZE.
+ * Self-contained one-shot call (PSA init, key import and destroy each
+ * time); the TX path uses the AEAD stream in aead.h with a session key
+ * instead.
  */
 void encrypt_character_array(const uint8_t *key,
                              const uint8_t *iv,
@@ -30,4 +35,3 @@ void encrypt_character_array(const uint8_t *key,
                              size_t length);
 
 #endif /* AES_GCM_H */
-
@@ -0,0 +1,39 @@
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+#include "data.h"
+
+// A transfer sends payload bytes [start_off, end) in chunks of chunk_size
+// bytes numbered from 0; the last one may be shorter.
+
+// Number of chunks for 'len' bytes.
+static inline uint16_t chunk_count(size_t len, size_t chunk_size)
+{
+    return (len + chunk_size - 1) / chunk_size;
+}
+
+// Payload offset of chunk seq.
+static inline size_t chunk_off(size_t start_off, size_t chunk_size, uint16_t seq)
+{
+    return start_off + (size_t)seq * chunk_size;
+}
+
+// Bytes in chunk seq.
+static inline size_t chunk_len(size_t start_off, size_t end, size_t chunk_size, uint16_t seq)
+{
+    return MIN(end - chunk_off(start_off, chunk_size, seq), chunk_size);
+}
+
+// Header of a windowed (WSTART) notification, written at hdr.
+static inline void chunk_hdr_put(uint8_t *hdr, uint16_t seq, uint16_t total)
+{
+    sys_put_le16(seq, hdr);
+    sys_put_le16(total, hdr + 2);
+}
+
+#endif // CHUNK_H
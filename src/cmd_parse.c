@@ -0,0 +1,149 @@
+/*
+ * Mule command syntax: the binary opcodes with their text names and
+ * argument types, and the text-to-binary translation. Kept apart from the
+ * handlers in sensor_logic.c so it can be benchmarked on its own.
+ */
+#include <zephyr/kernel.h>
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "cmd_parse.h"
+
+// Every command, in binary (op, argument bytes) and text form (name,
+// argument types: 'b' u8, 'h' u16, 'u' u32 in decimal, 'x' u32 in hex,
+// '*' the previous type repeated).
+//   START              stream the payload as raw notifications
+//   WSTART [<window>]  stream [chunk_hdr_t | data] chunks, at most <window>
+//                      beyond the last cumulative ACK
+//   ACK <n>            mule holds every chunk < n
+//   NACK <s> [<s>...]  mule is missing chunks s; they are resent first
+//   COC                stream the payload as SDUs on the L2CAP CoC the mule
+//                      opens to CONFIG_SENSOR_COC_PSM (NUS if it doesn't)
+//   STATUS             reply PENDING <token> <delivered> <len> or IDLE
+//                      (IDLE <acked> <end> with the sensor log: records
+//                      < acked are delivered, < end are stored)
+//   SYNC <seq> [<window>]
+//                      mule holds every record < <seq>: reply SYNC <first>
+//                      <end> and stream records [first, end) as a new
+//                      payload (windowed if <window> is given)
+//   RESUME <token> <offset> [<window>]
+//                      continue the payload identified by <token> (hex) from
+//                      byte <offset>; with <window> as in WSTART. Chunk
+//                      numbering restarts at 0 from <offset>.
+//   PREP               prepare the next payload now
+//   TRACE              print the trace ring on the console
+static const struct cmd_syntax cmd_syntax[] = {
+    { CMD_START,  0, "START",  ""    },
+    { CMD_STATUS, 0, "STATUS", ""    },
+    { CMD_RESUME, 8, "RESUME", "xub" },
+    { CMD_SYNC,   4, "SYNC",   "ub"  },
+    { CMD_WSTART, 0, "WSTART", "b"   },
+    { CMD_COC,    0, "COC",    ""    },
+    { CMD_PREP,   0, "PREP",   ""    },
+    { CMD_TRACE,  0, "TRACE",  ""    },
+    { CMD_NACK,   0, "NACK",   "h*"  },
+    { CMD_ACK,    0, "ACK",    "u"   },
+};
+
+// Parse the next unsigned decimal number in [*p, end), skipping spaces.
+static bool next_uint(const uint8_t **p, const uint8_t *end, uint32_t *out)
+{
+    const uint8_t *c = *p;
+    uint32_t v = 0;
+
+    while (c < end && *c == ' ') {
+        c++;
+    }
+    if (c >= end || *c < '0' || *c > '9') {
+        return false;
+    }
+    while (c < end && *c >= '0' && *c <= '9') {
+        v = v * 10 + (*c++ - '0');
+    }
+
+    *p = c;
+    *out = v;
+    return true;
+}
+
+// Parse the next hexadecimal number in [*p, end), skipping spaces.
+static bool next_hex(const uint8_t **p, const uint8_t *end, uint32_t *out)
+{
+    const uint8_t *c = *p;
+    uint32_t v = 0;
+    int digits = 0;
+
+    while (c < end && *c == ' ') {
+        c++;
+    }
+    for (; c < end && digits < 8; c++, digits++) {
+        uint8_t d = *c;
+
+        if (d >= '0' && d <= '9') {
+            d -= '0';
+        } else if ((d | 0x20) >= 'a' && (d | 0x20) <= 'f') {
+            d = (d | 0x20) - 'a' + 10;
+        } else {
+            break;
+        }
+        v = (v << 4) | d;
+    }
+    if (digits == 0) {
+        return false;
+    }
+
+    *p = c;
+    *out = v;
+    return true;
+}
+
+const struct cmd_syntax *cmd_syntax_of(uint8_t op)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(cmd_syntax); i++) {
+        if (cmd_syntax[i].op == op) {
+            return &cmd_syntax[i];
+        }
+    }
+    return NULL;
+}
+
+size_t cmd_from_text(const uint8_t *data, size_t len, uint8_t *out, size_t cap)
+{
+    const uint8_t *end = data + len;
+
+    for (size_t i = 0; i < ARRAY_SIZE(cmd_syntax); i++) {
+        const struct cmd_syntax *d = &cmd_syntax[i];
+        size_t n = strlen(d->name);
+        const uint8_t *p = data + n;
+        size_t o = 2;
+
+        if (len < n || memcmp(data, d->name, n)) {
+            continue;
+        }
+        for (const char *t = d->text_args; *t; t++) {
+            char type = (*t == '*') ? t[-1] : *t;
+            size_t w = (type == 'b') ? 1 : (type == 'h') ? 2 : 4;
+            uint32_t v;
+
+            if (o + w > cap ||
+                !(type == 'x' ? next_hex(&p, end, &v) : next_uint(&p, end, &v))) {
+                break;
+            }
+            if (w == 1) {
+                out[o] = MIN(v, UINT8_MAX);
+            } else if (w == 2) {
+                sys_put_le16(MIN(v, UINT16_MAX), &out[o]);
+            } else {
+                sys_put_le32(v, &out[o]);
+            }
+            o += w;
+            if (*t == '*') {
+                t--;   // once more
+            }
+        }
+        out[0] = d->op;
+        out[1] = o - 2;
+        return o;
+    }
+    return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef CMD_PARSE_H
+#define CMD_PARSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "data.h"
+
+// A mule command's binary opcode, its text name and argument types: 'b'
+// u8, 'h' u16, 'u' u32 in decimal, 'x' u32 in hex, '*' the previous type
+// repeated (see cmd_syntax[] in cmd_parse.c).
+struct cmd_syntax {
+    uint8_t op;
+    uint8_t min_len;          // argument bytes that must be present
+    const char *name;
+    const char *text_args;
+};
+
+// Syntax of binary opcode op, NULL if there is no such command.
+const struct cmd_syntax *cmd_syntax_of(uint8_t op);
+
+// Translate a text command into its binary form [op | len | args] in
+// out[0, cap). Arguments stop at the first one missing. Returns the
+// length, 0 if no command matches.
+size_t cmd_from_text(const uint8_t *data, size_t len, uint8_t *out, size_t cap);
+
+#endif // CMD_PARSE_H
@@ -0,0 +1,198 @@
+/*
+ * Payload compression: an optional delta pre-filter followed by LZSS, run
+ * as a stream so the raw data never has to sit in RAM as a whole.
+ *
+ * Delta filter (CODEC_DELTA_LZSS): each record is split into 16-bit
+ * little-endian lanes; every lane is replaced by its difference to the
+ * same lane of the previous record, zigzag-mapped and written as a LEB128
+ * varint. Slow-moving series turn into runs of short, repeating byte
+ * patterns, which LZSS then folds.
+ *
+ * LZSS: tokens in groups of eight, each group led by a flag byte (bit i,
+ * LSB first, set for a match). A literal is one byte. A match is a 16-bit
+ * little-endian word ((offset - 1) << 4 | (length - LZ_MIN_MATCH)) that
+ * copies 'length' bytes starting 'offset' bytes back in the output.
+ */
+#include <zephyr/kernel.h>
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "data.h"
+#include "compress.h"
+
+#define LZ_WINDOW     BIT(CONFIG_SENSOR_COMPRESS_WINDOW_BITS)
+#define LZ_MIN_MATCH  3
+#define LZ_MAX_MATCH  (LZ_MIN_MATCH + 15)
+
+#define REC_MAX       32                  // largest stride accepted
+#define REC_MAX_ENC   (REC_MAX / 2 * 3)   // a filtered record: 3-byte varint per lane
+
+BUILD_ASSERT(CONFIG_SENSOR_COMPRESS_WINDOW_BITS <= 12, "offsets are 12 bits");
+
+static struct {
+    // History [0, pos) and not yet encoded input [pos, end)
+    uint8_t  buf[2 * LZ_WINDOW + REC_MAX_ENC];
+    size_t   pos;
+    size_t   end;
+
+    // Output and the flag byte of the current token group
+    uint8_t *out;
+    size_t   len;
+    size_t   cap;
+    uint8_t *flags;
+    uint8_t  nflags;
+
+    // Delta filter: the previous record
+    uint8_t  prev[REC_MAX];
+} Z;
+
+// Room needed to encode n buffered bytes as literals, flag bytes included
+static inline size_t lz_worst(size_t n)
+{
+    return n + (n + 7) / 8;
+}
+
+static void lz_emit(bool match, const uint8_t *tok, size_t n)
+{
+    if (Z.nflags == 0) {
+        Z.flags = &Z.out[Z.len++];
+        *Z.flags = 0;
+    }
+    if (match) {
+        *Z.flags |= BIT(Z.nflags);
+    }
+    Z.nflags = (Z.nflags + 1) % 8;
+
+    memcpy(&Z.out[Z.len], tok, n);
+    Z.len += n;
+}
+
+// Longest match for the bytes at Z.pos within the window; 0 if none useful.
+static size_t lz_find(size_t *off)
+{
+    size_t max = MIN(Z.end - Z.pos, LZ_MAX_MATCH);
+    size_t lo = (Z.pos > LZ_WINDOW) ? Z.pos - LZ_WINDOW : 0;
+    const uint8_t *cur = &Z.buf[Z.pos];
+    size_t best = 0;
+
+    if (max < LZ_MIN_MATCH) {
+        return 0;
+    }
+
+    // Nearest candidates first: recent history is the likeliest to repeat
+    for (size_t c = Z.pos; c-- > lo;) {
+        const uint8_t *cand = &Z.buf[c];
+        size_t n;
+
+        if (cand[0] != cur[0] || cand[best] != cur[best]) {
+            continue;
+        }
+        for (n = 1; n < max && cand[n] == cur[n]; n++) {
+        }
+        if (n > best) {
+            best = n;
+            *off = Z.pos - c;
+            if (best == max) {
+                break;
+            }
+        }
+    }
+
+    return (best >= LZ_MIN_MATCH) ? best : 0;
+}
+
+// Encode buffered input, keeping LZ_MAX_MATCH bytes of lookahead unless
+// this is the final flush.
+static void lz_encode(bool flush)
+{
+    while (Z.pos < Z.end && (flush || Z.end - Z.pos >= LZ_MAX_MATCH)) {
+        size_t off;
+        size_t n = lz_find(&off);
+
+        if (n) {
+            uint8_t tok[2];
+
+            sys_put_le16(((off - 1) << 4) | (n - LZ_MIN_MATCH), tok);
+            lz_emit(true, tok, sizeof(tok));
+            Z.pos += n;
+        } else {
+            lz_emit(false, &Z.buf[Z.pos], 1);
+            Z.pos++;
+        }
+    }
+
+    // Keep one window of history and make room for the next record
+    if (Z.pos > LZ_WINDOW && Z.end + REC_MAX_ENC > sizeof(Z.buf)) {
+        size_t shift = Z.pos - LZ_WINDOW;
+
+        memmove(Z.buf, &Z.buf[shift], Z.end - shift);
+        Z.pos -= shift;
+        Z.end -= shift;
+    }
+}
+
+// Append one record to the encoder input, delta coded if asked.
+static void lz_put_record(const uint8_t *rec, uint8_t stride, bool delta)
+{
+    if (!delta) {
+        memcpy(&Z.buf[Z.end], rec, stride);
+        Z.end += stride;
+        return;
+    }
+
+    for (size_t i = 0; i < stride; i += 2) {
+        int16_t d = (int16_t)(sys_get_le16(&rec[i]) - sys_get_le16(&Z.prev[i]));
+        uint16_t zz = (uint16_t)((uint16_t)d << 1) ^ (uint16_t)(d >> 15);
+
+        while (zz >= 0x80) {
+            Z.buf[Z.end++] = (zz & 0x7f) | 0x80;
+            zz >>= 7;
+        }
+        Z.buf[Z.end++] = zz;
+    }
+    memcpy(Z.prev, rec, stride);
+}
+
+int compress_payload(uint8_t codec, uint8_t stride, compress_read_t read, void *arg,
+                     uint8_t *out, size_t cap, struct compress_report *rep)
+{
+    uint32_t t0 = k_cycle_get_32();
+    bool delta = (codec == CODEC_DELTA_LZSS);
+    size_t enc_max = delta ? stride / 2 * 3 : stride;
+    uint8_t rec[REC_MAX];
+    uint32_t raw_len = 0;
+    comp_hdr_t hdr = { .codec = codec, .stride = stride };
+
+    if (stride == 0 || stride > REC_MAX || (stride & 1) ||
+        (codec != CODEC_LZSS && codec != CODEC_DELTA_LZSS)) {
+        return -EINVAL;
+    }
+    if (cap < sizeof(hdr) + lz_worst(enc_max)) {
+        return -ENOSPC;
+    }
+
+    memset(&Z, 0, sizeof(Z));
+    Z.out = out;
+    Z.len = sizeof(hdr);
+    Z.cap = cap;
+
+    // Take a record only while everything buffered could still be written
+    // out as literals, so the flush below always fits.
+    while (Z.cap - Z.len >= lz_worst(Z.end - Z.pos + enc_max) + 1) {
+        if (read(arg, rec, stride) < stride) {
+            break;
+        }
+        lz_put_record(rec, stride, delta);
+        raw_len += stride;
+        lz_encode(false);
+    }
+    lz_encode(true);
+
+    hdr.raw_len = sys_cpu_to_le32(raw_len);
+    memcpy(out, &hdr, sizeof(hdr));
+
+    rep->raw_len = raw_len;
+    rep->out_len = Z.len;
+    rep->cycles  = k_cycle_get_32() - t0;
+    return Z.len;
+}
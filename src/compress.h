@@ -0,0 +1,27 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Pulls up to len raw bytes into dst; returns the count, fewer at the end.
+typedef int (*compress_read_t)(void *arg, uint8_t *dst, size_t len);
+
+// What one payload cost and saved
+struct compress_report {
+    uint32_t raw_len;     // raw bytes taken from the source
+    uint32_t out_len;     // frame bytes, comp_hdr_t included
+    uint32_t cycles;      // CPU cycles spent encoding
+};
+
+/*
+ * Fill out[0..cap) with one framed payload: comp_hdr_t, then raw bytes
+ * from read() encoded with 'codec' (CODEC_* in data.h). Input is taken in
+ * whole records of 'stride' bytes (even, at most 32) until the output is
+ * nearly full or the source runs dry, so rep->raw_len is always a
+ * multiple of stride. Returns the frame length or -errno.
+ */
+int compress_payload(uint8_t codec, uint8_t stride, compress_read_t read, void *arg,
+                     uint8_t *out, size_t cap, struct compress_report *rep);
+
+#endif // COMPRESS_H
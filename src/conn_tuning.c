@@ -0,0 +1,277 @@
+/*
+ * Connection tuning: right after connect, ask the mule for the fastest link
+ * it supports (max ATT MTU, data length extension, 2M PHY, short interval)
+ * and cache what was actually negotiated for the TX path.
+ */
+#include <zephyr/kernel.h>
+#include <string.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#include "conn_tuning.h"
+
+LOG_MODULE_DECLARE(peripheral_uart, CONFIG_NEBULA_LOG_LEVEL);
+
+// Negotiations still outstanding on a link
+#define TUNE_MTU    BIT(0)
+#define TUNE_DLE    BIT(1)
+#define TUNE_PHY    BIT(2)
+#define TUNE_PARAM  BIT(3)
+
+static struct tuning_slot {
+    struct bt_conn *conn;
+    struct conn_link link;
+    atomic_t pending;
+    uint32_t start_ms;
+    struct bt_gatt_exchange_params mtu_params;
+    struct k_work start_work;
+    struct k_work_delayable timeout_work;
+} slots[CONFIG_BT_MAX_CONN];
+
+static struct tuning_slot *slot_of(struct bt_conn *conn)
+{
+    struct tuning_slot *slot = &slots[bt_conn_index(conn)];
+
+    return (slot->conn == conn) ? slot : NULL;
+}
+
+static void tuning_report(struct tuning_slot *slot, bool timed_out)
+{
+    slot->link.tuned_ms = MAX(k_uptime_get_32() - slot->start_ms, 1);
+
+    LOG_INF("link %s in %u ms: MTU %u, LL len %u, PHY %u/%u, interval %u.%02u ms",
+            timed_out ? "partly tuned" : "tuned", slot->link.tuned_ms,
+            slot->link.mtu, slot->link.tx_len, slot->link.tx_phy, slot->link.rx_phy,
+            slot->link.interval * 5 / 4, (slot->link.interval * 125) % 100);
+}
+
+// One negotiation step finished (or was refused); report when all are done.
+static void tuning_done(struct tuning_slot *slot, atomic_val_t step)
+{
+    if (!(atomic_and(&slot->pending, ~step) & step)) {
+        return;
+    }
+    if (atomic_get(&slot->pending) == 0) {
+        k_work_cancel_delayable(&slot->timeout_work);
+        tuning_report(slot, false);
+    }
+}
+
+static void mtu_exchange_cb(struct bt_conn *conn, uint8_t err,
+                            struct bt_gatt_exchange_params *params)
+{
+    struct tuning_slot *slot = slot_of(conn);
+
+    if (!slot) {
+        return;
+    }
+    if (err) {
+        LOG_WRN("MTU exchange failed (err %u)", err);
+    }
+    slot->link.mtu = bt_gatt_get_mtu(conn);
+    tuning_done(slot, TUNE_MTU);
+}
+
+// Runs on the system workqueue: the update calls below wait for HCI command
+// completion, which must not happen in the BT RX thread.
+static void start_work_handler(struct k_work *work)
+{
+    struct tuning_slot *slot = CONTAINER_OF(work, struct tuning_slot, start_work);
+    struct bt_conn *conn = slot->conn;
+    int err;
+
+    if (!conn) {
+        return;
+    }
+
+#if defined(CONFIG_BT_GATT_CLIENT)
+    slot->mtu_params.func = mtu_exchange_cb;
+    err = bt_gatt_exchange_mtu(conn, &slot->mtu_params);
+    if (err) {
+        // -EALREADY: the mule already ran the exchange
+        slot->link.mtu = bt_gatt_get_mtu(conn);
+        tuning_done(slot, TUNE_MTU);
+    }
+#else
+    slot->link.mtu = bt_gatt_get_mtu(conn);
+    tuning_done(slot, TUNE_MTU);
+#endif
+
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+    err = bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX);
+    if (err) {
+        LOG_WRN("data length update failed (err %d)", err);
+        tuning_done(slot, TUNE_DLE);
+    }
+#else
+    tuning_done(slot, TUNE_DLE);
+#endif
+
+#if defined(CONFIG_SENSOR_CONN_PHY_2M)
+    err = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M);
+    if (err) {
+        LOG_WRN("PHY update failed (err %d)", err);
+        tuning_done(slot, TUNE_PHY);
+    }
+#else
+    tuning_done(slot, TUNE_PHY);
+#endif
+
+    const struct bt_le_conn_param param = {
+        .interval_min = CONFIG_SENSOR_CONN_INTERVAL_MIN,
+        .interval_max = CONFIG_SENSOR_CONN_INTERVAL_MAX,
+        .latency = 0,
+        .timeout = CONFIG_SENSOR_CONN_SUPERVISION_TIMEOUT,
+    };
+
+    err = bt_conn_le_param_update(conn, &param);
+    if (err) {
+        LOG_WRN("connection parameter update failed (err %d)", err);
+        tuning_done(slot, TUNE_PARAM);
+    }
+}
+
+// The mule may ignore or reject some requests; report what we have.
+static void timeout_work_handler(struct k_work *work)
+{
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct tuning_slot *slot = CONTAINER_OF(dwork, struct tuning_slot, timeout_work);
+
+    if (slot->conn && atomic_set(&slot->pending, 0)) {
+        tuning_report(slot, true);
+    }
+}
+
+static void refresh_info(struct tuning_slot *slot)
+{
+    struct bt_conn_info info;
+
+    if (bt_conn_get_info(slot->conn, &info)) {
+        return;
+    }
+    slot->link.interval = info.le.interval;
+    slot->link.latency = info.le.latency;
+#if defined(CONFIG_BT_USER_PHY_UPDATE)
+    slot->link.tx_phy = info.le.phy->tx_phy;
+    slot->link.rx_phy = info.le.phy->rx_phy;
+#endif
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+    slot->link.tx_len = info.le.data_len->tx_max_len;
+#endif
+}
+
+void conn_tuning_start(struct bt_conn *conn)
+{
+    struct tuning_slot *slot = &slots[bt_conn_index(conn)];
+
+    if (!IS_ENABLED(CONFIG_SENSOR_CONN_TUNING)) {
+        return;
+    }
+
+    memset(&slot->link, 0, sizeof(slot->link));
+    slot->conn = conn;
+    slot->start_ms = k_uptime_get_32();
+    slot->link.mtu = bt_gatt_get_mtu(conn);
+    refresh_info(slot);
+    atomic_set(&slot->pending, TUNE_MTU | TUNE_DLE | TUNE_PHY | TUNE_PARAM);
+
+    k_work_submit(&slot->start_work);
+    k_work_reschedule(&slot->timeout_work, K_MSEC(CONFIG_SENSOR_CONN_TUNING_TIMEOUT_MS));
+}
+
+void conn_tuning_stop(struct bt_conn *conn)
+{
+    struct tuning_slot *slot = slot_of(conn);
+
+    if (!slot) {
+        return;
+    }
+    slot->conn = NULL;
+    atomic_set(&slot->pending, 0);
+    k_work_cancel_delayable(&slot->timeout_work);
+}
+
+const struct conn_link *conn_tuning_get(struct bt_conn *conn)
+{
+    return &slots[bt_conn_index(conn)].link;
+}
+
+uint16_t conn_tuning_mtu(struct bt_conn *conn)
+{
+    struct tuning_slot *slot = slot_of(conn);
+
+    return (slot && slot->link.mtu) ? slot->link.mtu : bt_gatt_get_mtu(conn);
+}
+
+// ---- Stack callbacks: keep the cache in step with the link ----
+static void att_mtu_updated(struct bt_conn *conn, uint16_t tx, uint16_t rx)
+{
+    struct tuning_slot *slot = slot_of(conn);
+
+    if (slot) {
+        slot->link.mtu = bt_gatt_get_mtu(conn);
+        tuning_done(slot, TUNE_MTU);
+    }
+}
+
+static struct bt_gatt_cb gatt_callbacks = {
+    .att_mtu_updated = att_mtu_updated,
+};
+
+static void le_param_updated(struct bt_conn *conn, uint16_t interval,
+                             uint16_t latency, uint16_t timeout)
+{
+    struct tuning_slot *slot = slot_of(conn);
+
+    if (slot) {
+        slot->link.interval = interval;
+        slot->link.latency = latency;
+        tuning_done(slot, TUNE_PARAM);
+    }
+}
+
+#if defined(CONFIG_BT_USER_PHY_UPDATE)
+static void le_phy_updated(struct bt_conn *conn, struct bt_conn_le_phy_info *param)
+{
+    struct tuning_slot *slot = slot_of(conn);
+
+    if (slot) {
+        slot->link.tx_phy = param->tx_phy;
+        slot->link.rx_phy = param->rx_phy;
+        tuning_done(slot, TUNE_PHY);
+    }
+}
+#endif
+
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+static void le_data_len_updated(struct bt_conn *conn, struct bt_conn_le_data_len_info *info)
+{
+    struct tuning_slot *slot = slot_of(conn);
+
+    if (slot) {
+        slot->link.tx_len = info->tx_max_len;
+        tuning_done(slot, TUNE_DLE);
+    }
+}
+#endif
+
+BT_CONN_CB_DEFINE(conn_tuning_callbacks) = {
+    .le_param_updated    = le_param_updated,
+#if defined(CONFIG_BT_USER_PHY_UPDATE)
+    .le_phy_updated      = le_phy_updated,
+#endif
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+    .le_data_len_updated = le_data_len_updated,
+#endif
+};
+
+void conn_tuning_init(void)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(slots); i++) {
+        k_work_init(&slots[i].start_work, start_work_handler);
+        k_work_init_delayable(&slots[i].timeout_work, timeout_work_handler);
+    }
+    bt_gatt_cb_register(&gatt_callbacks);
+}
@@ -0,0 +1,29 @@
+#ifndef CONN_TUNING_H
+#define CONN_TUNING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/bluetooth/conn.h>
+
+// Link parameters as last reported by the stack for one connection
+struct conn_link {
+    uint16_t mtu;         // ATT MTU
+    uint16_t tx_len;      // LL TX payload octets (data length extension)
+    uint8_t  tx_phy;      // BT_GAP_LE_PHY_*
+    uint8_t  rx_phy;
+    uint16_t interval;    // connection interval, 1.25 ms units
+    uint16_t latency;
+    uint32_t tuned_ms;    // connect-to-negotiated time, 0 while pending
+};
+
+void conn_tuning_init(void);
+// Start negotiating MTU, data length, PHY and interval on a new link.
+void conn_tuning_start(struct bt_conn *conn);
+// Forget the link's cached parameters.
+void conn_tuning_stop(struct bt_conn *conn);
+// Cached parameters for conn (never NULL for a connected conn).
+const struct conn_link *conn_tuning_get(struct bt_conn *conn);
+// Cached ATT MTU for the TX path; falls back to the stack if not yet known.
+uint16_t conn_tuning_mtu(struct bt_conn *conn);
+
+#endif // CONN_TUNING_H
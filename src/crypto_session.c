@@ -0,0 +1,172 @@
+/*
+ * Crypto session: one PSA init and key import per boot, and counter-based
+ * nonces reserved in settings ahead of use (see crypto_session.h).
+ */
+#include <zephyr/kernel.h>
+#include <string.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/random/random.h>      // sys_csrand_get()
+#include <zephyr/settings/settings.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "crypto_session.h"
+#include "sensor_logic.h"
+
+LOG_MODULE_DECLARE(peripheral_uart, CONFIG_NEBULA_LOG_LEVEL);
+
+#define NONCE_SALT_SIZE  4
+
+// Demo key shared with the mule (AES-128 uses the first 16 bytes);
+// provision a per-device key for anything beyond the lab.
+static const uint8_t payload_key[AEAD_KEY_SIZE] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+#if AEAD_KEY_SIZE > 16
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+#endif
+};
+
+static struct {
+    psa_key_id_t key_id;
+
+    uint8_t  salt[NONCE_SALT_SIZE];
+    bool     have_salt;
+    bool     ready;       // counter loaded from settings
+    uint64_t next;        // next counter value to hand out
+    uint64_t reserved;    // values below this are covered by the saved end
+
+    struct k_mutex lock;
+    struct k_work reserve_work;
+} C;
+
+// Save a new end of reservation one block past what is in use. Caller
+// holds C.lock.
+static int reserve_block(void)
+{
+    uint64_t end = MAX(C.reserved, C.next) + CONFIG_SENSOR_NONCE_BLOCK;
+    int err = settings_save_one("crypto/ctr", &end, sizeof(end));
+
+    if (err) {
+        LOG_WRN("nonce block not reserved (err %d)", err);
+        return err;
+    }
+    C.reserved = end;
+    return 0;
+}
+
+// Keep half a block reserved ahead so nonces rarely wait for flash.
+// Runs on stage_q with the other flash writes.
+static void reserve_work_handler(struct k_work *work)
+{
+    k_mutex_lock(&C.lock, K_FOREVER);
+    if (C.ready && C.reserved - C.next <= CONFIG_SENSOR_NONCE_BLOCK / 2) {
+        (void)reserve_block();
+    }
+    k_mutex_unlock(&C.lock);
+}
+
+static int crypto_settings_set(const char *name, size_t len,
+                               settings_read_cb read_cb, void *cb_arg)
+{
+    int rc;
+
+    if (!strcmp(name, "salt") && len == sizeof(C.salt)) {
+        rc = read_cb(cb_arg, C.salt, sizeof(C.salt));
+        C.have_salt = (rc == sizeof(C.salt));
+    } else if (!strcmp(name, "ctr") && len == sizeof(C.reserved)) {
+        rc = read_cb(cb_arg, &C.reserved, sizeof(C.reserved));
+    } else {
+        return -ENOENT;
+    }
+    return (rc < 0) ? rc : 0;
+}
+
+// Settings are loaded: continue the counter after the last reservation.
+static int crypto_settings_commit(void)
+{
+    k_mutex_lock(&C.lock, K_FOREVER);
+
+    if (!C.have_salt) {
+        int err = sys_csrand_get(C.salt, sizeof(C.salt));
+
+        if (!err) {
+            err = settings_save_one("crypto/salt", C.salt, sizeof(C.salt));
+        }
+        if (err) {
+            LOG_ERR("nonce salt not created (err %d)", err);
+            k_mutex_unlock(&C.lock);
+            return err;
+        }
+        C.have_salt = true;
+    }
+
+    // Anything below the saved end may have been used before the reset
+    C.next = C.reserved;
+    C.ready = true;
+    k_mutex_unlock(&C.lock);
+
+    LOG_INF("nonce counter at %llu", (unsigned long long)C.next);
+    sensor_stage_submit(&C.reserve_work);
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(crypto, "crypto", NULL, crypto_settings_set,
+                               crypto_settings_commit, NULL);
+
+int crypto_session_init(void)
+{
+    psa_status_t status;
+
+    k_mutex_init(&C.lock);
+    k_work_init(&C.reserve_work, reserve_work_handler);
+
+    status = psa_crypto_init();
+    if (status != PSA_SUCCESS) {
+        LOG_ERR("psa_crypto_init failed (%d)", (int)status);
+        return -EIO;
+    }
+
+    // Volatile key: imported once here, lives until reset
+    status = aead_import_key(payload_key, &C.key_id);
+    if (status != PSA_SUCCESS) {
+        LOG_ERR("psa_import_key failed (%d)", (int)status);
+        return -EIO;
+    }
+    LOG_INF("payload AEAD: %s", AEAD_NAME);
+    return 0;
+}
+
+psa_key_id_t crypto_session_key(void)
+{
+    return C.key_id;
+}
+
+int crypto_session_next_nonce(uint8_t nonce[AEAD_IV_SIZE], uint32_t count)
+{
+    int err = 0;
+
+    k_mutex_lock(&C.lock, K_FOREVER);
+
+    if (!C.ready) {
+        err = -EAGAIN;
+    }
+    // The read-ahead reservation did not keep up: save one now
+    while (!err && C.next + count > C.reserved) {
+        err = reserve_block();
+    }
+    if (err) {
+        k_mutex_unlock(&C.lock);
+        return err;
+    }
+
+    memcpy(nonce, C.salt, sizeof(C.salt));
+    sys_put_be64(C.next, nonce + sizeof(C.salt));
+    C.next += count;
+
+    if (C.reserved - C.next <= CONFIG_SENSOR_NONCE_BLOCK / 2) {
+        sensor_stage_submit(&C.reserve_work);
+    }
+    k_mutex_unlock(&C.lock);
+    return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef CRYPTO_SESSION_H
+#define CRYPTO_SESSION_H
+
+#include <stdint.h>
+#include <psa/crypto.h>
+
+#include "aead.h"
+
+/*
+ * Crypto state that lives for the whole boot: PSA is initialized and the
+ * payload key imported once, and nonces come from a counter instead of the
+ * entropy source.
+ *
+ * Nonce = salt:4 | counter:8 (big-endian). The salt is drawn once per
+ * device and kept in settings. Counter values are reserved in blocks of
+ * CONFIG_SENSOR_NONCE_BLOCK: the end of the block is saved before any value
+ * in it is used, and a reboot continues from the saved end, so a nonce is
+ * never reused even if the device resets mid-block.
+ */
+
+// Initialize PSA and import the payload key. Returns 0 or -errno.
+int crypto_session_init(void);
+// Key handle for payload encryption (PSA_KEY_ID_NULL before init).
+psa_key_id_t crypto_session_key(void);
+// Write the next unused nonce and reserve it and the count - 1 counter
+// values after it for the caller. Returns 0, -EAGAIN until the counter has
+// been loaded from settings, or -errno if no counter block could be saved.
+int crypto_session_next_nonce(uint8_t nonce[AEAD_IV_SIZE], uint32_t count);
+
+#endif // CRYPTO_SESSION_H
@@ -6,7 +6,146 @@
 
 // Same meaning as the old project
 typedef struct __packed {
-    uint8_t num_chunks;   // total chunks to send
-    uint8_t chunks_rx;    // acks received from central
-    uint8_t ready;        // 0=idle, 1=sending, 2=done
+    uint16_t num_chunks;  // total chunks to send
+    uint16_t chunks_rx;   // acks received from central (cumulative)
+    uint8_t  ready;       // 0=idle, 1=sending, 2=done
 } meta_t;
+
+// Header prepended to every notification in windowed (WSTART) mode.
+// Both fields are little-endian on air.
+typedef struct __packed {
+    uint16_t seq;         // chunk index, 0..total-1
+    uint16_t total;       // number of chunks in this payload
+} chunk_hdr_t;
+
+// Binary mule commands. A write holds one or more commands back to back,
+// each [op:u8 | len:u8 | args[len]] with little-endian arguments. Opcodes
+// have the top bit set, so byte 0 tells them from the text commands.
+// Arguments in [] may be left out (len says so).
+#define CMD_START    0x80u  // -
+#define CMD_WSTART   0x81u  // [window:u8]
+#define CMD_ACK      0x82u  // next:u32
+#define CMD_NACK     0x83u  // seq:u16 ...
+#define CMD_STATUS   0x84u  // -, replies cmd_status_rsp_t
+#define CMD_SYNC     0x85u  // seq:u32 [window:u8], replies cmd_sync_rsp_t
+#define CMD_RESUME   0x86u  // token:u32 offset:u32 [window:u8]
+#define CMD_COC      0x87u  // -
+#define CMD_PREP     0x88u  // -
+#define CMD_TRACE    0x89u  // -, trace ring printed on the console
+
+// Replies to binary commands: [op:u8 | len:u8 | body], op as in the request
+typedef struct __packed {
+    uint8_t  pending;     // 1: a payload is part-delivered (RESUME possible)
+    uint32_t a;           // pending: token;     idle: records acked
+    uint32_t b;           // pending: delivered; idle: records stored
+    uint32_t c;           // pending: length;    idle: 0
+} cmd_status_rsp_t;
+
+#define CMD_SYNC_OK      0u  // payload holds records [first, end)
+#define CMD_SYNC_BUSY    1u  // a transfer is running; try again later
+#define CMD_SYNC_NODATA  2u  // nothing past seq; first = end = records stored
+
+typedef struct __packed {
+    uint8_t  status;      // CMD_SYNC_*
+    uint32_t first;
+    uint32_t end;
+} cmd_sync_rsp_t;
+
+// Nebula service data in the advertising data, after the 16-bit UUID.
+// Sized to fill a legacy advertising packet next to the flags and the NUS
+// UUID. Multi-byte fields are little-endian.
+#define ADV_FLAG_RESUME       0x01u   // a partial payload can be RESUMEd
+#define ADV_URGENCY_SHIFT     1       // flags bits 1-2: ADV_URGENCY_*
+#define ADV_URGENCY_MASK      (3u << ADV_URGENCY_SHIFT)
+#define ADV_URGENCY_NONE      0u      // nothing to deliver
+#define ADV_URGENCY_LOW       1u      // data waiting
+#define ADV_URGENCY_HIGH      2u      // sensor log at least half full
+#define ADV_URGENCY_CRITICAL  3u      // log about to overwrite undelivered data
+#define ADV_PENDING_UNIT      64u     // pending is counted in these, rounded up
+
+typedef struct __packed {
+    uint8_t  flags;       // ADV_FLAG_* | urgency << ADV_URGENCY_SHIFT
+    uint16_t pending;     // undelivered bytes / ADV_PENDING_UNIT, saturating
+    uint8_t  end_seq[3];  // low 24 bits of the next record's sequence number
+} nebula_adv_t;
+
+// Transfer outcomes (metrics_rec_t.outcome)
+#define XFER_OUT_DONE     0u  // every byte delivered
+#define XFER_OUT_STOPPED  1u  // disconnect, CoC drop or restarted by the mule
+#define XFER_OUT_TIMEOUT  2u  // windowed mule stopped answering probes
+#define XFER_OUT_FAILED   3u  // fatal send error
+
+// One finished transfer, as kept in the metrics history and read from the
+// stats characteristic. Multi-byte fields are little-endian on air.
+typedef struct __packed {
+    uint16_t id;          // transfer number since boot
+    uint8_t  outcome;     // XFER_OUT_*
+    uint8_t  transport;   // 0 NUS raw, 1 NUS windowed, 2 L2CAP CoC
+    uint16_t mtu;         // ATT MTU at start
+    uint8_t  tx_phy;      // BT_GAP_LE_PHY_*
+    uint8_t  rx_phy;
+    uint16_t interval;    // connection interval, 1.25 ms units
+    uint16_t chunks;      // chunks handed to the stack, resends included
+    uint16_t retransmits;
+    uint16_t enomem;      // sends retried because the stack had no buffer
+    uint16_t fatal;       // send errors that stopped the transfer
+    uint32_t bytes;       // chunk bytes handed to the stack
+    uint32_t delivered;   // payload bytes the mule holds
+    uint32_t ttfb_us;     // start command dequeued to first chunk handed to the stack
+    uint32_t duration_ms; // start command to the end of the transfer
+    uint32_t goodput;     // delivered bytes per second
+    uint8_t  per_event;   // chunks per connection event, pacing estimate
+    uint8_t  window;      // pacing window at the end, chunks
+    uint8_t  window_max;  // largest pacing window reached
+    uint16_t backoffs;    // pacing window halvings on -ENOMEM
+} metrics_rec_t;
+
+// Stats characteristic value: this header, then up to 'count' records,
+// newest first
+typedef struct __packed {
+    uint8_t  version;     // 1
+    uint8_t  count;
+    uint8_t  rec_size;    // sizeof(metrics_rec_t), for forward compatibility
+} metrics_hdr_t;
+
+// How a sample's 16-bit value is to be read
+#define REC_T_I16    0u   // signed, device units
+#define REC_T_U16    1u   // unsigned, device units
+#define REC_T_CENTI  2u   // signed hundredths (e.g. 0.01 degC)
+#define REC_T_EVENT  3u   // event code, no magnitude
+
+// One reading taken by the sampling thread, stored as is in the sensor log
+// (host byte order). Its sequence number is its index in the log.
+typedef struct __packed {
+    uint32_t t_ms;        // uptime when sampled
+    uint8_t  stream;      // sensor stream ID, 0..15
+    uint8_t  type;        // REC_T_*
+    int16_t  value;       // reading; unsigned for REC_T_U16/REC_T_EVENT
+} sample_rec_t;
+
+// Payload codecs (CONFIG_SENSOR_COMPRESS)
+#define CODEC_NONE        0u  // raw bytes
+#define CODEC_LZSS        1u  // LZSS tokens
+#define CODEC_DELTA_LZSS  2u  // per-record lane deltas as varints, then LZSS
+#define CODEC_RECORDS     3u  // rec_pkt_hdr_t packets of packed records
+
+// Frame header that starts every payload when compression is built in.
+// raw_len is little-endian on air.
+typedef struct __packed {
+    uint8_t  codec;       // CODEC_*
+    uint8_t  stride;      // record size the delta filter used, in bytes
+    uint32_t raw_len;     // bytes after decoding
+} comp_hdr_t;
+
+// CODEC_RECORDS: the payload is a run of fixed-size packets, one per
+// notification when the link allows, each decodable on its own. The
+// header is followed by records until 'len'; the rest is zero padding.
+// Record: tag (stream << 4 | type), zigzag varint of the time since the
+// previous record (t0_ms for the first), then the value as a varint,
+// zigzag-mapped for the signed types.
+typedef struct __packed {
+    uint8_t  codec;       // CODEC_RECORDS, so payloads are told apart by byte 0
+    uint8_t  len;         // bytes used, this header included
+    uint32_t first_seq;   // sequence number of the first record (LE)
+    uint32_t t0_ms;       // time base of the packet (LE)
+} rec_pkt_hdr_t;
@@ -0,0 +1,63 @@
+#ifndef HOT_LOG_H
+#define HOT_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+/*
+ * Rate-limited logging for messages on the transfer and command paths,
+ * which can otherwise fire once per chunk. Each call site logs at most once
+ * per CONFIG_SENSOR_LOG_RATELIMIT_MS; the message after a quiet spell is
+ * followed by the number of copies dropped. Callers must have the module's
+ * LOG_MODULE_DECLARE in scope, as for LOG_WRN(); below the module's level
+ * the call site compiles to nothing.
+ */
+
+struct hot_log_site {
+    uint32_t last_ms;
+    uint16_t dropped;
+    bool     seen;
+};
+
+// True if the call site may log now; otherwise counts a dropped message.
+// Races between threads can only let an extra message through.
+static inline bool hot_log_pass(struct hot_log_site *s, uint16_t *dropped)
+{
+    uint32_t now = k_uptime_get_32();
+
+    if (CONFIG_SENSOR_LOG_RATELIMIT_MS > 0 && s->seen &&
+        now - s->last_ms < CONFIG_SENSOR_LOG_RATELIMIT_MS) {
+        if (s->dropped < UINT16_MAX) {
+            s->dropped++;
+        }
+        return false;
+    }
+    *dropped = s->dropped;
+    s->dropped = 0;
+    s->last_ms = now;
+    s->seen = true;
+    return true;
+}
+
+#define HOT_LOG(_level, ...)                                              \
+    do {                                                                  \
+        static struct hot_log_site _hl_site;                              \
+        uint16_t _hl_dropped;                                             \
+                                                                          \
+        if (Z_LOG_CONST_LEVEL_CHECK(LOG_LEVEL_##_level) &&               \
+            hot_log_pass(&_hl_site, &_hl_dropped)) {                      \
+            LOG_##_level(__VA_ARGS__);                                    \
+            if (_hl_dropped) {                                            \
+                LOG_##_level("(%u more like it dropped)", _hl_dropped);   \
+            }                                                             \
+        }                                                                 \
+    } while (0)
+
+#define HOT_LOG_ERR(...) HOT_LOG(ERR, __VA_ARGS__)
+#define HOT_LOG_WRN(...) HOT_LOG(WRN, __VA_ARGS__)
+#define HOT_LOG_INF(...) HOT_LOG(INF, __VA_ARGS__)
+#define HOT_LOG_DBG(...) HOT_LOG(DBG, __VA_ARGS__)
+
+#endif // HOT_LOG_H
@@ -0,0 +1,433 @@
+/*
+ * Sensor log on ZMS/NVS: appends are collected in a RAM block and written
+ * as one entry of CONFIG_SENSOR_LOG_BLOCK_SIZE bytes when it fills. Block
+ * n of the log is stored under ID LOG_ID_DATA + n % n_blocks, so a full log
+ * overwrites its oldest block.
+ *
+ * IDs are reused in the order they were written. When the file system
+ * garbage-collects its oldest sector, every block in it has therefore been
+ * superseded already: nothing has to be copied, and each sector is erased
+ * once per lap of the ring. n_blocks is sized so that this holds.
+ */
+#include <zephyr/kernel.h>
+#include <string.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/drivers/flash.h>
+#include <zephyr/storage/flash_map.h>
+
+#if defined(CONFIG_ZMS)
+#include <zephyr/fs/zms.h>
+#else
+#include <zephyr/fs/nvs.h>
+#endif
+
+#include "log_store.h"
+#include "hot_log.h"
+
+LOG_MODULE_DECLARE(peripheral_uart, CONFIG_NEBULA_LOG_LEVEL);
+
+// Same calls on either backend; ZMS is used on RRAM/MRAM parts.
+#if defined(CONFIG_ZMS)
+typedef struct zms_fs log_fs_t;
+#define LOG_FS_ATE_SIZE 16
+#define log_fs_mount    zms_mount
+#define log_fs_read     zms_read
+#define log_fs_write    zms_write
+#else
+typedef struct nvs_fs log_fs_t;
+#define LOG_FS_ATE_SIZE 8
+#define log_fs_mount    nvs_mount
+#define log_fs_read     nvs_read
+#define log_fs_write    nvs_write
+#endif
+
+// The log has a partition of its own. Carving it out of storage_partition
+// would depend on the settings backend's sector count never changing: a
+// device whose settings were written over more sectors would lose them.
+#if !FIXED_PARTITION_EXISTS(sensor_log_partition)
+#error "CONFIG_SENSOR_LOG needs a sensor_log_partition fixed partition"
+#endif
+#define LOG_PARTITION sensor_log_partition
+
+#define LOG_ID_META  0u   // struct log_meta
+#define LOG_ID_DATA  1u   // first block ID
+
+// Save the head in the meta entry every this many blocks (fewer on a
+// small ring, see log_store_init()); at mount the blocks written since are
+// found by probing forward from it.
+#define LOG_META_EVERY 16u
+
+// Stored block: header, then up to LOG_BLK_DATA bytes
+struct log_blk_hdr {
+    uint32_t seq;         // block number in the log
+    uint16_t len;         // data bytes; < LOG_BLK_DATA only for a flushed head
+    uint16_t reserved;
+};
+
+#define LOG_BLK_DATA ((uint32_t)(CONFIG_SENSOR_LOG_BLOCK_SIZE - sizeof(struct log_blk_hdr)))
+
+struct log_meta {
+    uint32_t consumed;    // byte position
+    uint32_t head;        // a block number <= the real head
+};
+
+static struct {
+    log_fs_t fs;
+    bool     ready;
+    uint32_t n_blocks;    // blocks kept in flash
+    uint32_t head;        // block being filled in RAM
+    uint32_t consumed;    // byte position
+    uint32_t meta_head;   // head last saved in the meta entry
+    uint32_t meta_every;  // blocks between meta saves, < n_blocks
+    struct k_mutex lock;
+
+    // Head block, written out when full or on log_store_flush()
+    struct log_blk_hdr hdr;
+    uint8_t  data[LOG_BLK_DATA];
+
+    // Last block read back, so chunks inside one block cost one flash read
+    uint32_t cache_seq;
+    uint16_t cache_len;
+    uint8_t  cache[CONFIG_SENSOR_LOG_BLOCK_SIZE];
+} L;
+
+static inline uint32_t id_of(uint32_t seq)
+{
+    return LOG_ID_DATA + seq % L.n_blocks;
+}
+
+// Oldest block still in flash. The head shares its ID with the block
+// n_blocks before it, which is gone once the head has been written.
+static inline uint32_t tail_of(void)
+{
+    return (L.head >= L.n_blocks) ? L.head - L.n_blocks + 1 : 0;
+}
+
+static int meta_save(void)
+{
+    struct log_meta meta = { .consumed = L.consumed, .head = L.head };
+    ssize_t rc = log_fs_write(&L.fs, LOG_ID_META, &meta, sizeof(meta));
+
+    if (rc < 0) {
+        return (int)rc;
+    }
+    L.meta_head = L.head;
+    return 0;
+}
+
+// Write the head block under its ID. Caller holds L.lock.
+static int head_write(void)
+{
+    ssize_t rc;
+
+    L.hdr.seq = L.head;
+    memcpy(L.cache, &L.hdr, sizeof(L.hdr));
+    memcpy(L.cache + sizeof(L.hdr), L.data, L.hdr.len);
+
+    rc = log_fs_write(&L.fs, id_of(L.head), L.cache, sizeof(L.hdr) + L.hdr.len);
+    // L.cache now holds the head block, which may still grow
+    L.cache_seq = UINT32_MAX;
+    return (rc < 0) ? (int)rc : 0;
+}
+
+// The head block is full and stored: start the next one.
+static void head_advance(void)
+{
+    uint32_t tail;
+
+    L.head++;
+    L.hdr.len = 0;
+
+    tail = tail_of();
+    if (L.consumed < tail * LOG_BLK_DATA) {
+        HOT_LOG_WRN("log full, %u undelivered bytes overwritten",
+                    tail * LOG_BLK_DATA - L.consumed);
+        L.consumed = tail * LOG_BLK_DATA;
+    }
+    if (L.head - L.meta_head >= L.meta_every) {
+        (void)meta_save();
+    }
+}
+
+int log_store_append(const void *data, size_t len)
+{
+    const uint8_t *src = data;
+    int err = 0;
+
+    if (!L.ready) {
+        return -ENODEV;
+    }
+
+    k_mutex_lock(&L.lock, K_FOREVER);
+    for (;;) {
+        if (L.hdr.len == LOG_BLK_DATA) {
+            err = head_write();
+            if (err) {
+                // The full block stays in RAM; the next append retries it.
+                LOG_ERR("log block %u not written (err %d)", L.head, err);
+                break;
+            }
+            head_advance();
+        }
+        if (len == 0) {
+            break;
+        }
+
+        size_t n = MIN(len, LOG_BLK_DATA - L.hdr.len);
+
+        memcpy(&L.data[L.hdr.len], src, n);
+        L.hdr.len += n;
+        src += n;
+        len -= n;
+    }
+    k_mutex_unlock(&L.lock);
+    return err;
+}
+
+int log_store_flush(void)
+{
+    int err = 0;
+
+    if (!L.ready) {
+        return -ENODEV;
+    }
+
+    k_mutex_lock(&L.lock, K_FOREVER);
+    if (L.hdr.len > 0) {
+        // Stored under the same ID again once full; only the newest counts.
+        err = head_write();
+    }
+    k_mutex_unlock(&L.lock);
+    return err;
+}
+
+void log_store_cursor(struct log_cursor *c)
+{
+    k_mutex_lock(&L.lock, K_FOREVER);
+    c->pos = L.consumed;
+    k_mutex_unlock(&L.lock);
+}
+
+// Bring block seq into L.cache. Caller holds L.lock.
+static int cache_load(uint32_t seq)
+{
+    struct log_blk_hdr hdr;
+    ssize_t rc;
+
+    if (L.cache_seq == seq) {
+        return 0;
+    }
+
+    rc = log_fs_read(&L.fs, id_of(seq), L.cache, sizeof(L.cache));
+    if (rc < (ssize_t)sizeof(hdr)) {
+        return (rc < 0) ? (int)rc : -EIO;
+    }
+    memcpy(&hdr, L.cache, sizeof(hdr));
+    if (hdr.seq != seq || hdr.len > LOG_BLK_DATA) {
+        return -EIO;
+    }
+
+    L.cache_seq = seq;
+    L.cache_len = hdr.len;
+    return 0;
+}
+
+int log_store_read(struct log_cursor *c, void *dst, size_t len)
+{
+    uint8_t *out = dst;
+    size_t done = 0;
+    uint32_t end;
+
+    if (!L.ready) {
+        return -ENODEV;
+    }
+
+    k_mutex_lock(&L.lock, K_FOREVER);
+    end = L.head * LOG_BLK_DATA + L.hdr.len;
+    c->pos = MAX(c->pos, tail_of() * LOG_BLK_DATA);
+
+    while (done < len && c->pos < end) {
+        uint32_t seq = c->pos / LOG_BLK_DATA;
+        uint32_t off = c->pos % LOG_BLK_DATA;
+        const uint8_t *src;
+        size_t avail;
+
+        if (seq == L.head) {
+            // Not in flash yet
+            src = L.data;
+            avail = L.hdr.len;
+        } else {
+            int err = cache_load(seq);
+
+            if (err) {
+                LOG_ERR("log block %u unreadable (err %d)", seq, err);
+                k_mutex_unlock(&L.lock);
+                return done ? (int)done : err;
+            }
+            src = L.cache + sizeof(struct log_blk_hdr);
+            avail = L.cache_len;
+        }
+
+        size_t n = MIN(len - done, avail - off);
+
+        memcpy(out + done, src + off, n);
+        done += n;
+        c->pos += n;
+    }
+    k_mutex_unlock(&L.lock);
+    return (int)done;
+}
+
+int log_store_consume(const struct log_cursor *c)
+{
+    int err = 0;
+
+    if (!L.ready) {
+        return -ENODEV;
+    }
+
+    k_mutex_lock(&L.lock, K_FOREVER);
+    if (c->pos > L.consumed && c->pos <= L.head * LOG_BLK_DATA + L.hdr.len) {
+        L.consumed = c->pos;
+        err = meta_save();
+    }
+    k_mutex_unlock(&L.lock);
+    return err;
+}
+
+size_t log_store_pending(void)
+{
+    size_t pending;
+
+    if (!L.ready) {
+        return 0;
+    }
+
+    k_mutex_lock(&L.lock, K_FOREVER);
+    pending = L.head * LOG_BLK_DATA + L.hdr.len - L.consumed;
+    k_mutex_unlock(&L.lock);
+    return pending;
+}
+
+size_t log_store_capacity(void)
+{
+    // The head block is in RAM; the oldest of n_blocks is gone once it is
+    // written
+    return L.ready ? (L.n_blocks - 1) * LOG_BLK_DATA : 0;
+}
+
+uint32_t log_store_end(void)
+{
+    uint32_t end;
+
+    if (!L.ready) {
+        return 0;
+    }
+
+    k_mutex_lock(&L.lock, K_FOREVER);
+    end = L.head * LOG_BLK_DATA + L.hdr.len;
+    k_mutex_unlock(&L.lock);
+    return end;
+}
+
+// Find the head: walk forward from the last saved one over full blocks. A
+// partly filled block there was flushed and goes back into RAM.
+static void head_recover(const struct log_meta *meta)
+{
+    L.head = meta->head;
+    L.consumed = meta->consumed;
+    L.hdr.len = 0;
+
+    for (;;) {
+        ssize_t rc = log_fs_read(&L.fs, id_of(L.head), L.cache, sizeof(L.cache));
+        struct log_blk_hdr hdr;
+
+        if (rc < (ssize_t)sizeof(hdr)) {
+            break;
+        }
+        memcpy(&hdr, L.cache, sizeof(hdr));
+        if (hdr.seq != L.head || hdr.len > LOG_BLK_DATA) {
+            break;
+        }
+        if (hdr.len < LOG_BLK_DATA) {
+            memcpy(L.data, L.cache + sizeof(hdr), hdr.len);
+            L.hdr.len = hdr.len;
+            break;
+        }
+        L.head++;
+    }
+
+    L.consumed = MAX(L.consumed, tail_of() * LOG_BLK_DATA);
+    L.consumed = MIN(L.consumed, L.head * LOG_BLK_DATA + L.hdr.len);
+    L.meta_head = meta->head;
+    L.cache_seq = UINT32_MAX;
+}
+
+int log_store_init(void)
+{
+    const struct device *dev = FIXED_PARTITION_DEVICE(LOG_PARTITION);
+    off_t part_off = FIXED_PARTITION_OFFSET(LOG_PARTITION);
+    size_t part_size = FIXED_PARTITION_SIZE(LOG_PARTITION);
+    struct flash_pages_info info;
+    struct log_meta meta = { 0 };
+    size_t per_sector;
+    ssize_t rc;
+    int err;
+
+    k_mutex_init(&L.lock);
+
+    if (!device_is_ready(dev)) {
+        LOG_ERR("log flash device not ready");
+        return -ENODEV;
+    }
+
+    err = flash_get_page_info_by_offs(dev, part_off, &info);
+    if (err) {
+        LOG_ERR("log flash page info failed (err %d)", err);
+        return err;
+    }
+
+    if (part_size < 3 * info.size) {
+        // Need two sectors for the ring plus the file system's spare one
+        LOG_ERR("sensor_log_partition too small: %u bytes, need 3 sectors",
+                (unsigned)part_size);
+        return -ENOSPC;
+    }
+
+    L.fs.flash_device = dev;
+    L.fs.offset = part_off;
+    L.fs.sector_size = info.size;
+    L.fs.sector_count = part_size / info.size;
+
+    err = log_fs_mount(&L.fs);
+    if (err) {
+        LOG_ERR("log mount failed (err %d)", err);
+        return err;
+    }
+
+    // Every block of the ring must have been superseded by the time its
+    // sector is collected: the ring spans all sectors but the one being
+    // written and the file system's spare one. Each sector also holds a
+    // few allocation entries of its own.
+    per_sector = (info.size - 4 * LOG_FS_ATE_SIZE) /
+                 (CONFIG_SENSOR_LOG_BLOCK_SIZE + LOG_FS_ATE_SIZE);
+    L.n_blocks = (L.fs.sector_count - 2) * per_sector;
+    if (L.n_blocks < 2) {
+        LOG_ERR("log sectors too small for CONFIG_SENSOR_LOG_BLOCK_SIZE");
+        return -ENOSPC;
+    }
+    // Probing forward from the saved head only works while the ring has
+    // not wrapped past it
+    L.meta_every = MIN(LOG_META_EVERY, L.n_blocks - 1);
+
+    rc = log_fs_read(&L.fs, LOG_ID_META, &meta, sizeof(meta));
+    if (rc != sizeof(meta)) {
+        memset(&meta, 0, sizeof(meta));
+    }
+    head_recover(&meta);
+    L.ready = true;
+
+    LOG_INF("sensor log: %u blocks of %u bytes, %u bytes pending",
+            L.n_blocks, (unsigned)LOG_BLK_DATA, (unsigned)log_store_pending());
+    return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef LOG_STORE_H
+#define LOG_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Append-only circular sensor log in internal flash (ZMS or NVS).
+ *
+ * Every byte ever appended has a position, counting up from 0 since the
+ * log was first mounted. The log keeps the newest bytes that fit the
+ * partition; when it is full the oldest block is overwritten, delivered or
+ * not. Bytes below the consumed mark have reached a mule and are not read
+ * again.
+ */
+
+// Read position in the log (byte offset since the log was created)
+struct log_cursor {
+    uint32_t pos;
+};
+
+// Mount the log and recover head and consumed mark. Returns 0 or -errno.
+int log_store_init(void);
+// Queue bytes for the log; a block is written to flash each time one fills.
+int log_store_append(const void *data, size_t len);
+// Write the partly filled block now (e.g. before power down).
+int log_store_flush(void);
+
+// Cursor at the oldest byte not consumed yet
+void log_store_cursor(struct log_cursor *c);
+// Copy up to len bytes at c into dst and advance c. Returns the number of
+// bytes copied (0 at the end of the log) or -errno. A cursor that fell
+// behind the oldest block still stored is moved up to it first.
+int log_store_read(struct log_cursor *c, void *dst, size_t len);
+// Everything before c has been delivered. The mark is saved in flash.
+int log_store_consume(const struct log_cursor *c);
+// Bytes between the consumed mark and the end of the log
+size_t log_store_pending(void);
+// Undelivered bytes the log holds before it overwrites any
+size_t log_store_capacity(void);
+// Position just past the newest byte appended
+uint32_t log_store_end(void);
+
+#endif // LOG_STORE_H
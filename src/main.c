@@ -21,6 +21,7 @@
 #include <zephyr/bluetooth/uuid.h>
 #include <zephyr/bluetooth/gatt.h>
 #include <zephyr/bluetooth/hci.h>
+#include <zephyr/sys/byteorder.h>
 
 #include <zephyr/bluetooth/services/nus.h>
 
@@ -35,9 +36,12 @@
 
 #include "data.h"
 #include "sensor_logic.h"
+#include "conn_tuning.h"
+#include "sampler.h"
+#include "trace.h"
 
 #define LOG_MODULE_NAME peripheral_uart
-LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+LOG_MODULE_REGISTER(LOG_MODULE_NAME, CONFIG_NEBULA_LOG_LEVEL);
 
 /* Default Nordic UART Service (NUS) UUID in little-endian byte order */
 #define BT_UUID_NUS_VAL \
@@ -56,45 +60,134 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 
 #define CON_STATUS_LED DK_LED2
 
-struct bt_conn *current_conn = NULL; // global, not static
-static struct k_work adv_work;
+// One reference per connected mule, indexed by bt_conn_index()
+static struct bt_conn *conns[CONFIG_BT_MAX_CONN];
+static size_t conn_count;
+static struct k_work_delayable adv_work;
 
-// Advertise both the 128-bit NUS UUID and the 16-bit Nebula identifier UUID
+// Nebula service data: [UUID16 | nebula_adv_t]. Rebuilt on every
+// advertising refresh so a mule can rank sensors before connecting.
+static struct {
+    uint8_t uuid[2];
+    nebula_adv_t info;
+} __packed nebula_svc_data = { .uuid = { BT_UUID_16_ENCODE(BT_UUID_NEBULA_VAL) } };
+
+// The flags, the 128-bit NUS UUID and the Nebula service data fill the 31
+// bytes of a legacy advertising packet
 static const struct bt_data ad[] = {
     BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
     /* Advertise the 128-bit NUS Service UUID. No extra parentheses needed. */
     BT_DATA_BYTES(BT_DATA_UUID128_ALL, BT_UUID_NUS_VAL),
-    /* Advertise the 16-bit custom Nebula UUID as an identifier */
-    BT_DATA_BYTES(BT_DATA_UUID16_ALL, BT_UUID_16_ENCODE(BT_UUID_NEBULA_VAL)),
+    /* Backlog summary so a mule can skip sensors with nothing to give */
+    BT_DATA(BT_DATA_SVC_DATA16, &nebula_svc_data, sizeof(nebula_svc_data)),
 };
 
-// Put the name in the scan response packet for debugging
+// Put the name and the 16-bit Nebula identifier in the scan response
 static const struct bt_data sd[] = {
+    BT_DATA_BYTES(BT_DATA_UUID16_ALL, BT_UUID_16_ENCODE(BT_UUID_NEBULA_VAL)),
     BT_DATA(BT_DATA_NAME_COMPLETE, DEVICE_NAME, DEVICE_NAME_LEN),
 };
 
+BUILD_ASSERT(CONFIG_SENSOR_ADV_BURST_MS < CONFIG_SENSOR_ADV_REFRESH_S * 1000,
+             "the fast burst must be shorter than the refresh period");
+
+// Advertising schedule: slow while there is nothing to deliver; with data
+// waiting, each refresh period starts with a fast burst; fast throughout
+// when the sensor log is about to overwrite undelivered data.
+static struct {
+    bool on;              // advertiser running (it stops when a mule connects)
+    bool fast;            // ... at the fast interval
+    bool in_burst;        // the current period's burst is running
+} A;
+
 static void advertising_start(void);
 
+static uint8_t adv_urgency(const struct sensor_backlog *b)
+{
+    if (b->pending == 0) {
+        return ADV_URGENCY_NONE;
+    }
+    if (b->fill_pct >= CONFIG_SENSOR_ADV_URGENT_PCT) {
+        return ADV_URGENCY_CRITICAL;
+    }
+    return (b->fill_pct >= 50) ? ADV_URGENCY_HIGH : ADV_URGENCY_LOW;
+}
+
+static void adv_fill(const struct sensor_backlog *b, uint8_t urgency)
+{
+    nebula_adv_t *info = &nebula_svc_data.info;
+
+    info->flags = (b->resume ? ADV_FLAG_RESUME : 0) | (urgency << ADV_URGENCY_SHIFT);
+    info->pending = sys_cpu_to_le16(MIN(DIV_ROUND_UP(b->pending, ADV_PENDING_UNIT),
+                                        UINT16_MAX));
+    sys_put_le24(b->end_seq, info->end_seq);
+}
+
 static void adv_work_handler(struct k_work *work)
 {
-    // Use the modern, non-deprecated advertising parameters
+    struct sensor_backlog b;
+    uint32_t period_ms = CONFIG_SENSOR_ADV_REFRESH_S * 1000;
+    uint32_t next_ms = period_ms;
+    uint8_t urgency;
+    bool fast;
+    int err;
+
+    sensor_backlog(&b);
+    urgency = adv_urgency(&b);
+    adv_fill(&b, urgency);
+
+    if (urgency == ADV_URGENCY_NONE) {
+        fast = false;
+        A.in_burst = false;
+    } else if (urgency == ADV_URGENCY_CRITICAL) {
+        fast = true;
+    } else if (!A.in_burst) {
+        fast = true;
+        A.in_burst = true;
+        next_ms = CONFIG_SENSOR_ADV_BURST_MS;
+    } else {
+        fast = false;
+        A.in_burst = false;
+        next_ms = period_ms - CONFIG_SENSOR_ADV_BURST_MS;
+    }
+    k_work_reschedule(&adv_work, K_MSEC(next_ms));
+
+    // No room for another mule: advertise again after a disconnect
+    if (conn_count >= CONFIG_BT_MAX_CONN) {
+        return;
+    }
+
+    if (A.on && A.fast == fast &&
+        bt_le_adv_update_data(ad, ARRAY_SIZE(ad), sd, ARRAY_SIZE(sd)) == 0) {
+        return;
+    }
+
+    // The interval only changes with a restart
+    uint32_t units = (fast ? CONFIG_SENSOR_ADV_FAST_INT_MS : CONFIG_SENSOR_ADV_SLOW_INT_MS)
+                     * 8 / 5;
     struct bt_le_adv_param adv_param = {
         .id = BT_ID_DEFAULT,
         .sid = 0,
         .secondary_max_skip = 0,
         .options = BT_LE_ADV_OPT_CONNECTABLE,
-        .interval_min = BT_GAP_ADV_FAST_INT_MIN_2,
-        .interval_max = BT_GAP_ADV_FAST_INT_MAX_2,
+        .interval_min = units,
+        // Legacy advertising tops out at 10.24 s
+        .interval_max = MIN(units + units / 2, BT_GAP_ADV_MAX_ADV_INTERVAL),
         .peer = NULL,
     };
 
-    int err = bt_le_adv_start(&adv_param, ad, ARRAY_SIZE(ad),
-                  sd, ARRAY_SIZE(sd));
+    // The host may have resumed advertising by itself after a connection
+    (void)bt_le_adv_stop();
+    A.on = false;
+    err = bt_le_adv_start(&adv_param, ad, ARRAY_SIZE(ad), sd, ARRAY_SIZE(sd));
     if (err) {
         LOG_ERR("Advertising failed to start (err %d)", err);
-    } else {
-        LOG_INF("Advertising successfully started");
+        return;
     }
+    A.on = true;
+    A.fast = fast;
+    LOG_INF("Advertising %s: %u B pending, urgency %u", fast ? "fast" : "slow",
+            b.pending, urgency);
 }
 
 // called when bluetooth device connects successfully to nrf
@@ -112,9 +205,22 @@ static void connected(struct bt_conn *conn, uint8_t err)
         addr, sizeof(addr) 
     ); // convert binary address to readable string
     LOG_INF("Connected %s", addr); 
+    trace_mark(TR_CONN, bt_conn_index(conn), 0);
 
-    current_conn = bt_conn_ref(conn);
+    conns[bt_conn_index(conn)] = bt_conn_ref(conn);
+    conn_count++;
     dk_set_led_on(CON_STATUS_LED);
+    // A connectable advertiser stops once a central connects
+    A.on = false;
+
+    sensor_conn_add(conn);
+    // Ask for the fastest link the mule supports before bulk transfer starts
+    conn_tuning_start(conn);
+
+    // Keep advertising while there is room for another mule
+    if (conn_count < CONFIG_BT_MAX_CONN) {
+        advertising_start();
+    }
 }
 
 // called when bluetooth device disconnects from nrf
@@ -125,16 +231,23 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
     bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 
     LOG_INF("Disconnected from %s (reason 0x%02x)", addr, reason);
+    trace_mark(TR_DISCONN, bt_conn_index(conn), reason);
 
-    if (current_conn) {
-        bt_conn_unref(current_conn);
-        current_conn = NULL;
-        // Immediately stop any ongoing data transfer.
-        sensor_stop_transfer();
+    conn_tuning_stop(conn);
+
+    if (conns[bt_conn_index(conn)] == conn) {
+        // Immediately stop this mule's data transfer; others keep going.
+        sensor_conn_remove(conn);
+        bt_conn_unref(conn);
+        conns[bt_conn_index(conn)] = NULL;
+        conn_count--;
+    }
+    if (conn_count == 0) {
+        dk_set_led_off(CON_STATUS_LED);
     }
 
     // Restart advertising
-    k_work_submit(&adv_work);
+    advertising_start();
 }
 
 /*
@@ -152,10 +265,12 @@ BT_CONN_CB_DEFINE(conn_callbacks) = {
     .recycled         = recycled_cb,
 };
 
-// ADD THIS FUNCTION DEFINITION
+// Rebuild the advertising data and restart the schedule now, beginning
+// with a burst if there is data waiting
 static void advertising_start(void)
 {
-    k_work_submit(&adv_work);
+    A.in_burst = false;
+    k_work_reschedule(&adv_work, K_NO_WAIT);
 }
 
 static void error(void)
@@ -185,6 +300,10 @@ int main(void)
 
     configure_gpio(); // configure pins and LED
     sensor_init();
+    conn_tuning_init();
+#if defined(CONFIG_SENSOR_SAMPLER)
+    sampler_init();
+#endif
 
     err = bt_enable(NULL);
     if (err) {
@@ -197,7 +316,10 @@ int main(void)
         settings_load();
     }
 
-    k_work_init(&adv_work, adv_work_handler);
+    // Resume state and nonce counter are loaded: stage the first payload
+    sensor_stage_next();
+
+    k_work_init_delayable(&adv_work, adv_work_handler);
     advertising_start();
 
     // send hello message every 5 seconds
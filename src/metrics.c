@@ -0,0 +1,207 @@
+/*
+ * Transfer metrics: per-transfer counters filled in by the TX path, a
+ * history of the last finished transfers, and two ways to read it: the
+ * Nebula stats GATT characteristic (for mules) and the "metrics" shell
+ * command (for the bench). See metrics.h.
+ */
+#include <zephyr/kernel.h>
+#include <string.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/gatt.h>
+#if defined(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+#endif
+
+#include "metrics.h"
+#include "conn_tuning.h"
+
+LOG_MODULE_DECLARE(peripheral_uart, CONFIG_NEBULA_LOG_LEVEL);
+
+static struct {
+    // Ring of finished transfers; hist[(head - 1) % N] is the newest
+    metrics_rec_t hist[CONFIG_SENSOR_METRICS_HISTORY];
+    size_t   head;
+    size_t   count;
+    uint16_t next_id;
+    struct k_spinlock lock;
+} M;
+
+void metrics_xfer_begin(struct metrics_xfer *m, struct bt_conn *conn, uint8_t transport,
+                        int64_t t0)
+{
+    const struct conn_link *link = conn_tuning_get(conn);
+
+    memset(m, 0, sizeof(*m));
+    m->rec.transport = transport;
+    if (link) {
+        m->rec.mtu      = link->mtu;
+        m->rec.tx_phy   = link->tx_phy;
+        m->rec.rx_phy   = link->rx_phy;
+        m->rec.interval = link->interval;
+    }
+    m->t0 = t0;
+    m->active = true;
+}
+
+void metrics_xfer_sent(struct metrics_xfer *m, size_t len, bool retx)
+{
+    if (m->rec.chunks == 0) {
+        m->rec.ttfb_us = k_ticks_to_us_floor32(k_uptime_ticks() - m->t0);
+    }
+    if (m->rec.chunks < UINT16_MAX) {
+        m->rec.chunks++;
+    }
+    if (retx && m->rec.retransmits < UINT16_MAX) {
+        m->rec.retransmits++;
+    }
+    m->rec.bytes += len;
+}
+
+void metrics_xfer_end(struct metrics_xfer *m, uint8_t outcome, uint32_t delivered)
+{
+    metrics_rec_t *r = &m->rec;
+    uint32_t ms = k_ticks_to_ms_ceil32(k_uptime_ticks() - m->t0);
+    k_spinlock_key_t key;
+
+    if (!m->active) {
+        return;
+    }
+    m->active = false;
+
+    r->outcome     = outcome;
+    r->fatal      += (outcome == XFER_OUT_FAILED);
+    r->delivered   = delivered;
+    r->duration_ms = ms;
+    r->goodput     = ms ? (uint32_t)((uint64_t)delivered * 1000 / ms) : 0;
+
+    key = k_spin_lock(&M.lock);
+    r->id = M.next_id++;
+    M.hist[M.head] = *r;
+    M.head = (M.head + 1) % ARRAY_SIZE(M.hist);
+    M.count = MIN(M.count + 1, ARRAY_SIZE(M.hist));
+    k_spin_unlock(&M.lock, key);
+
+    LOG_INF("transfer %u: %u B in %u ms (%u B/s), first chunk after %u us, "
+            "%u resent, %u ENOMEM, window %u/%u of %u per event, %u backoffs",
+            r->id, r->delivered, r->duration_ms, r->goodput, r->ttfb_us,
+            r->retransmits, r->enomem, r->window, r->window_max, r->per_event,
+            r->backoffs);
+}
+
+size_t metrics_history(metrics_rec_t *out, size_t max)
+{
+    k_spinlock_key_t key = k_spin_lock(&M.lock);
+    size_t n = MIN(max, M.count);
+
+    for (size_t i = 0; i < n; i++) {
+        out[i] = M.hist[(M.head + ARRAY_SIZE(M.hist) - 1 - i) % ARRAY_SIZE(M.hist)];
+    }
+    k_spin_unlock(&M.lock, key);
+    return n;
+}
+
+static void metrics_clear(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&M.lock);
+
+    M.head = 0;
+    M.count = 0;
+    k_spin_unlock(&M.lock, key);
+}
+
+// ---- Nebula stats service ----
+// Read-only characteristic: metrics_hdr_t, then the history newest first.
+// Records are stored in CPU byte order, which is little-endian on every
+// nRF core, so the value goes out as is. Longer than one ATT MTU when the
+// history is full: the mule reads it with a long (offset) read.
+
+#define BT_UUID_NEBULA_STATS_SVC \
+    BT_UUID_DECLARE_128(BT_UUID_128_ENCODE(0x4e420001, 0x6d75, 0x6c65, 0xa8e2, 0x5b1c0f3d9e77))
+#define BT_UUID_NEBULA_STATS_HIST \
+    BT_UUID_DECLARE_128(BT_UUID_128_ENCODE(0x4e420002, 0x6d75, 0x6c65, 0xa8e2, 0x5b1c0f3d9e77))
+
+#if defined(CONFIG_BT_NUS_SECURITY_ENABLED)
+#define STATS_PERM BT_GATT_PERM_READ_ENCRYPT
+#else
+#define STATS_PERM BT_GATT_PERM_READ
+#endif
+
+// Value as of the last read at offset 0. Later offsets of a long read are
+// served from it, so the parts fit together even if a transfer ends in
+// between. All reads run in the BT RX thread, one at a time.
+static struct {
+    metrics_hdr_t hdr;
+    metrics_rec_t rec[CONFIG_SENSOR_METRICS_HISTORY];
+} __packed snap;
+
+static ssize_t read_history(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                            void *buf, uint16_t len, uint16_t offset)
+{
+    if (offset == 0) {
+        snap.hdr.version  = 1;
+        snap.hdr.rec_size = sizeof(metrics_rec_t);
+        snap.hdr.count    = metrics_history(snap.rec, ARRAY_SIZE(snap.rec));
+    }
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &snap,
+                             sizeof(snap.hdr) + snap.hdr.count * sizeof(metrics_rec_t));
+}
+
+BT_GATT_SERVICE_DEFINE(nebula_stats_svc,
+    BT_GATT_PRIMARY_SERVICE(BT_UUID_NEBULA_STATS_SVC),
+    BT_GATT_CHARACTERISTIC(BT_UUID_NEBULA_STATS_HIST, BT_GATT_CHRC_READ,
+                           STATS_PERM, read_history, NULL, NULL),
+);
+
+// ---- Shell ----
+#if defined(CONFIG_SHELL)
+static const char *const outcome_name[] = {
+    [XFER_OUT_DONE]    = "done",
+    [XFER_OUT_STOPPED] = "stopped",
+    [XFER_OUT_TIMEOUT] = "timeout",
+    [XFER_OUT_FAILED]  = "failed",
+};
+
+static int cmd_metrics_show(const struct shell *sh, size_t argc, char **argv)
+{
+    metrics_rec_t rec[CONFIG_SENSOR_METRICS_HISTORY];
+    size_t n = metrics_history(rec, ARRAY_SIZE(rec));
+
+    if (n == 0) {
+        shell_print(sh, "no transfers yet");
+        return 0;
+    }
+    shell_print(sh, "  id outcome  tr  mtu phy  bytes  deliv chunks retx nomem "
+                "ttfb_us    ms     B/s ev win/max back");
+    for (size_t i = 0; i < n; i++) {
+        const metrics_rec_t *r = &rec[i];
+
+        shell_print(sh, "%4u %-8s %2u %4u %u/%u %6u %6u %6u %4u %5u %7u %5u %7u "
+                    "%2u %3u/%-3u %4u",
+                    r->id, r->outcome < ARRAY_SIZE(outcome_name) ?
+                    outcome_name[r->outcome] : "?",
+                    r->transport, r->mtu, r->tx_phy, r->rx_phy, r->bytes,
+                    r->delivered, r->chunks, r->retransmits, r->enomem,
+                    r->ttfb_us, r->duration_ms, r->goodput, r->per_event,
+                    r->window, r->window_max, r->backoffs);
+    }
+    return 0;
+}
+
+static int cmd_metrics_clear(const struct shell *sh, size_t argc, char **argv)
+{
+    metrics_clear();
+    shell_print(sh, "metrics history cleared");
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_metrics,
+    SHELL_CMD(show, NULL, "List recent transfers, newest first", cmd_metrics_show),
+    SHELL_CMD(clear, NULL, "Forget the transfer history", cmd_metrics_clear),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(metrics, &sub_metrics, "Transfer metrics", cmd_metrics_show);
+#endif // CONFIG_SHELL
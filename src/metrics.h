@@ -0,0 +1,66 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/bluetooth/conn.h>
+
+#include "data.h"
+
+/*
+ * Transfer metrics: each transfer context carries a struct metrics_xfer
+ * that the TX path updates as it goes; when the transfer ends its record
+ * joins a history of the last CONFIG_SENSOR_METRICS_HISTORY transfers.
+ * The history is readable on the Nebula stats GATT characteristic and
+ * with the "metrics" shell command. Without CONFIG_SENSOR_METRICS the
+ * hooks compile to nothing.
+ */
+struct metrics_xfer {
+    metrics_rec_t rec;
+    int64_t  t0;          // uptime ticks the start command was dequeued
+    bool     active;
+};
+
+#if defined(CONFIG_SENSOR_METRICS)
+// A transfer starts on conn for a start command dequeued at uptime ticks
+// t0; ttfb_us and duration_ms count from there. The link parameters are
+// taken from now.
+void metrics_xfer_begin(struct metrics_xfer *m, struct bt_conn *conn, uint8_t transport,
+                        int64_t t0);
+// One chunk of 'len' bytes was handed to the stack.
+void metrics_xfer_sent(struct metrics_xfer *m, size_t len, bool retx);
+// The stack had no buffer for a chunk; it will be retried.
+static inline void metrics_xfer_enomem(struct metrics_xfer *m)
+{
+    m->rec.enomem++;
+}
+// Pacing state (pacing.h) to file with the record.
+static inline void metrics_xfer_pacing(struct metrics_xfer *m, uint8_t per_event,
+                                       uint8_t window, uint8_t window_max,
+                                       uint16_t backoffs)
+{
+    m->rec.per_event  = per_event;
+    m->rec.window     = window;
+    m->rec.window_max = window_max;
+    m->rec.backoffs   = backoffs;
+}
+// The transfer ended (XFER_OUT_*) with 'delivered' bytes at the mule; its
+// record joins the history. Nothing happens if it was not active.
+void metrics_xfer_end(struct metrics_xfer *m, uint8_t outcome, uint32_t delivered);
+
+// Copy up to 'max' records, newest first; returns how many.
+size_t metrics_history(metrics_rec_t *out, size_t max);
+#else
+static inline void metrics_xfer_begin(struct metrics_xfer *m, struct bt_conn *conn,
+                                      uint8_t transport, int64_t t0) {}
+static inline void metrics_xfer_sent(struct metrics_xfer *m, size_t len, bool retx) {}
+static inline void metrics_xfer_enomem(struct metrics_xfer *m) {}
+static inline void metrics_xfer_pacing(struct metrics_xfer *m, uint8_t per_event,
+                                       uint8_t window, uint8_t window_max,
+                                       uint16_t backoffs) {}
+static inline void metrics_xfer_end(struct metrics_xfer *m, uint8_t outcome,
+                                    uint32_t delivered) {}
+#endif
+
+#endif // METRICS_H
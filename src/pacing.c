@@ -0,0 +1,110 @@
+/*
+ * TX pacing: an additive-increase, multiplicative-decrease window per
+ * transfer, capped by how many chunks the link's connection events carry.
+ * See pacing.h.
+ */
+#include <zephyr/kernel.h>
+#include <string.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+
+#include "pacing.h"
+#include "conn_tuning.h"
+
+#define T_IFS_US       150u
+#define L2CAP_ATT_HDR  7u     // L2CAP header (4) + ATT notification header (3)
+
+// Assumed until conn_tuning.c knows better (or without it): the LE
+// defaults, and a 7.5 ms interval
+#define DEFAULT_INTERVAL  6u
+#define DEFAULT_TX_LEN    27u
+
+// -ENOMEM retries wait one connection event, doubling up to 2^3 = 8
+#define NOMEM_MAX_SHIFT   3u
+
+// Airtime of one LL data packet with n payload bytes (Core 6.0, Vol 6,
+// Part B, 2.1 and 2.2). Coded PHY is taken as S=8, the slower coding.
+static uint32_t ll_airtime_us(uint8_t phy, uint32_t n)
+{
+    switch (phy) {
+    case BT_GAP_LE_PHY_2M:
+        // preamble 2, access address 4, header 2, CRC 3 bytes at 4 us
+        return (n + 11) * 4;
+    case BT_GAP_LE_PHY_CODED:
+        // preamble, access address, CI and TERM1 take 376 us; header,
+        // payload and CRC 64 us per byte; TERM2 24 us
+        return 400 + (n + 5) * 64;
+    default:
+        // preamble 1, access address 4, header 2, CRC 3 bytes at 8 us
+        return (n + 10) * 8;
+    }
+}
+
+// Chunks per connection event from the link as cached by conn_tuning.c.
+// Each LL packet we send costs its airtime, the central's empty reply and
+// two inter-frame spaces; the controller closes the event at the next
+// interval or after CONFIG_SENSOR_PACE_EVENT_LEN_US, whichever is first.
+static void pacer_estimate(struct pacer *p, const struct conn_link *link)
+{
+    uint16_t interval = link->interval ? link->interval : DEFAULT_INTERVAL;
+    uint16_t tx_len = link->tx_len ? link->tx_len : DEFAULT_TX_LEN;
+    uint8_t phy = link->tx_phy ? link->tx_phy : BT_GAP_LE_PHY_1M;
+    uint32_t exchange_us = ll_airtime_us(phy, tx_len) + ll_airtime_us(phy, 0) + 2 * T_IFS_US;
+    uint32_t ll_per_chunk = DIV_ROUND_UP(p->chunk_len + L2CAP_ATT_HDR, tx_len);
+    uint32_t event_us = interval * 1250u;
+    uint32_t busy_us = MIN(event_us, CONFIG_SENSOR_PACE_EVENT_LEN_US);
+    uint32_t per_event = MAX(busy_us / exchange_us / ll_per_chunk, 1);
+
+    p->interval  = link->interval;
+    p->tx_len    = link->tx_len;
+    p->tx_phy    = link->tx_phy;
+    p->event_us  = event_us;
+    p->per_event = MIN(per_event, UINT8_MAX);
+    // Two events' worth: the next event's chunks are queued while this
+    // one is on air
+    p->ceiling   = CLAMP(2 * per_event, 1, CONFIG_SENSOR_TX_PIPELINE_DEPTH);
+    p->window_x16 = MIN(p->window_x16, p->ceiling * 16);
+}
+
+void pacer_start(struct pacer *p, struct bt_conn *conn, size_t chunk_len)
+{
+    memset(p, 0, sizeof(*p));
+    p->conn = conn;
+    p->chunk_len = MIN(chunk_len, UINT16_MAX);
+    p->window_x16 = UINT16_MAX;
+    pacer_estimate(p, conn_tuning_get(conn));
+
+    // Start at half an event's worth and ramp up from there
+    p->window_x16 = MIN(DIV_ROUND_UP(p->per_event, 2), p->ceiling) * 16;
+    p->window_max = pacer_window(p);
+}
+
+void pacer_on_done(struct pacer *p)
+{
+    const struct conn_link *link = conn_tuning_get(p->conn);
+
+    p->nomem_run = 0;
+    // Tuning may finish after the transfer started
+    if (link->interval != p->interval || link->tx_len != p->tx_len ||
+        link->tx_phy != p->tx_phy) {
+        pacer_estimate(p, link);
+    }
+    if (p->window_x16 < p->ceiling * 16) {
+        // + 1/window chunks per completion: one chunk per window sent
+        p->window_x16 = MIN(p->window_x16 + MAX(256 / p->window_x16, 1), p->ceiling * 16);
+        p->window_max = MAX(p->window_max, pacer_window(p));
+    }
+}
+
+k_timeout_t pacer_on_nomem(struct pacer *p)
+{
+    p->window_x16 = MAX(p->window_x16 / 2, 16);
+    if (p->backoffs < UINT16_MAX) {
+        p->backoffs++;
+    }
+    if (p->nomem_run < UINT8_MAX) {
+        p->nomem_run++;
+    }
+    // Buffers come back as the next connection event drains the queue
+    return K_USEC(p->event_us << MIN(p->nomem_run - 1u, NOMEM_MAX_SHIFT));
+}
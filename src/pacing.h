@@ -0,0 +1,49 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/conn.h>
+
+/*
+ * TX pacing for one transfer: how many chunks it may keep queued to the
+ * stack. The window grows additively (by about one chunk per window of
+ * completed chunks, i.e. per connection event once the link is busy) and
+ * halves on every -ENOMEM. It never exceeds what two connection events can
+ * carry on the link, estimated from the connection interval, PHY and LL
+ * payload length that conn_tuning.c caches, so the stack always has the
+ * next event's data without piling up sends it cannot take. Retries after
+ * -ENOMEM wait for the next connection event rather than a fixed delay.
+ */
+struct pacer {
+    struct bt_conn *conn;
+    uint16_t chunk_len;   // bytes of one chunk on the wire (SDU/notification)
+    uint16_t window_x16;  // current window, chunks * 16
+    uint8_t  ceiling;     // window cap: two events' worth, chunks
+    uint8_t  per_event;   // chunks one connection event carries (estimate)
+    uint8_t  window_max;  // largest window reached
+    uint8_t  nomem_run;   // -ENOMEM retries since the last completion
+    uint16_t backoffs;    // multiplicative decreases
+    uint16_t interval;    // link parameters the estimate was made for
+    uint16_t tx_len;
+    uint8_t  tx_phy;
+    uint32_t event_us;    // connection interval, us
+};
+
+// A transfer starts on conn with chunks of chunk_len bytes.
+void pacer_start(struct pacer *p, struct bt_conn *conn, size_t chunk_len);
+// One chunk left the stack: grow the window.
+void pacer_on_done(struct pacer *p);
+// The stack had no buffer: halve the window. Returns how long to wait
+// before retrying if nothing else is in flight to wake the TX path.
+k_timeout_t pacer_on_nomem(struct pacer *p);
+
+// Chunks the transfer may have in flight now (at least 1).
+static inline uint8_t pacer_window(const struct pacer *p)
+{
+    return MAX(p->window_x16 / 16, 1);
+}
+
+#endif // PACING_H
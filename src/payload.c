@@ -0,0 +1,86 @@
+/*
+ * Payload plaintext from sensor log records, see payload.h. The codecs are
+ * the ones built in: LZSS with CONFIG_SENSOR_COMPRESS, packed records
+ * with CONFIG_SENSOR_COMPRESS_RECORDS.
+ */
+#include <zephyr/kernel.h>
+#include <errno.h>
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "payload.h"
+#include "record.h"
+
+// Raw records, behind a CODEC_NONE header if framed
+static int encode_raw(const struct payload_src *src, bool framed, uint8_t *dst, size_t cap,
+                      struct payload_enc *out)
+{
+    comp_hdr_t hdr = { .codec = CODEC_NONE };
+    size_t off = framed ? sizeof(hdr) : 0;
+    int n;
+
+    if (cap < off) {
+        return -ENOMEM;
+    }
+
+    // Whole records only, so every payload starts on a sequence number
+    n = src->read(src->arg, dst + off, ROUND_DOWN(cap - off, sizeof(sample_rec_t)));
+    if (n < 0) {
+        return n;
+    }
+
+    if (framed) {
+        hdr.raw_len = sys_cpu_to_le32(n);
+        memcpy(dst, &hdr, sizeof(hdr));
+    }
+    out->len = off + n;
+    out->raw_len = n;
+    return 0;
+}
+
+int payload_encode(const struct payload_src *src, const struct payload_codec *codec,
+                   uint8_t *dst, size_t cap, struct payload_enc *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    switch (codec->codec) {
+    case CODEC_NONE:
+        return encode_raw(src, codec->framed, dst, cap, out);
+#if defined(CONFIG_SENSOR_COMPRESS)
+    case CODEC_LZSS:
+    case CODEC_DELTA_LZSS: {
+        int n = compress_payload(codec->codec, sizeof(sample_rec_t), src->read, src->arg,
+                                 dst, cap, &out->comp);
+
+        if (n > 0 && out->comp.out_len < out->comp.raw_len + sizeof(comp_hdr_t)) {
+            out->len = n;
+            out->raw_len = out->comp.raw_len;
+            return 0;
+        }
+        memset(&out->comp, 0, sizeof(out->comp));
+        break;
+    }
+#endif
+#if defined(CONFIG_SENSOR_COMPRESS_RECORDS)
+    case CODEC_RECORDS: {
+        size_t n = rec_encode_payload(src->read, src->arg, src->first_seq, dst, cap,
+                                      codec->rec_pkt, &out->records);
+
+        if (n > 0 && out->records > 0) {
+            out->len = n;
+            out->raw_len = out->records * sizeof(sample_rec_t);
+            out->pkt = codec->rec_pkt;
+            return 0;
+        }
+        out->records = 0;
+        break;
+    }
+#endif
+    default:
+        return -ENOTSUP;
+    }
+
+    // Not worth encoding: send the records as they are
+    src->rewind(src->arg);
+    return encode_raw(src, true, dst, cap, out);
+}
@@ -0,0 +1,51 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "data.h"
+#include "compress.h"
+
+/*
+ * Payload plaintext from sensor log records: the encoding step of
+ * payload_fill() (src/sensor_logic.c), free of Bluetooth, settings and
+ * the log store so bench/datapath times the same code. Sealing is
+ * aead_payload_begin() (src/aead.h).
+ */
+
+// Log bytes to encode; read() as for compress_payload()
+struct payload_src {
+    compress_read_t read;
+    void  (*rewind)(void *arg); // back to the first byte, for the raw fallback
+    void   *arg;
+    uint32_t first_seq;   // sequence number of the first record
+};
+
+struct payload_codec {
+    uint8_t  codec;       // CODEC_* (data.h)
+    bool     framed;      // comp_hdr_t in front, as with CONFIG_SENSOR_COMPRESS
+    uint16_t rec_pkt;     // CODEC_RECORDS packet size
+};
+
+// What payload_encode() wrote
+struct payload_enc {
+    size_t   len;         // plaintext bytes
+    uint32_t raw_len;     // log bytes they hold, whole records
+    uint32_t records;     // CODEC_RECORDS: records packed, else 0
+    uint16_t pkt;         // CODEC_RECORDS: packet size, else 0
+    struct compress_report comp; // LZSS codecs: what they saved, else zero
+};
+
+/*
+ * Fill dst[0..cap) with the records from src encoded with codec->codec.
+ * Payloads the codec packs nothing into or would not make smaller hold
+ * the raw records behind a CODEC_NONE header instead; unframed payloads
+ * (CODEC_NONE only) hold them bare. Returns 0 or -errno; raw_len 0 means
+ * the source had nothing.
+ */
+int payload_encode(const struct payload_src *src, const struct payload_codec *codec,
+                   uint8_t *dst, size_t cap, struct payload_enc *out);
+
+#endif // PAYLOAD_H
@@ -0,0 +1,110 @@
+/*
+ * Packed record encoding (CODEC_RECORDS). A raw sample_rec_t takes 8 bytes;
+ * packed, a periodic sample usually takes 4: one tag byte, a 2-byte time
+ * delta and a 1-2 byte value. Sequence numbers are not sent per record:
+ * records in a packet are consecutive from first_seq.
+ */
+#include <zephyr/kernel.h>
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "record.h"
+
+static size_t put_varint(uint8_t *dst, uint32_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        dst[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    dst[n++] = v;
+    return n;
+}
+
+static inline uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+void rec_pack_begin(struct rec_packer *p, uint8_t *pkt, size_t size,
+                    uint32_t first_seq, uint32_t t0_ms)
+{
+    rec_pkt_hdr_t hdr = {
+        .codec     = CODEC_RECORDS,
+        .first_seq = sys_cpu_to_le32(first_seq),
+        .t0_ms     = sys_cpu_to_le32(t0_ms),
+    };
+
+    memcpy(pkt, &hdr, sizeof(hdr));
+    p->pkt = pkt;
+    p->size = MIN(size, UINT8_MAX);
+    p->len = sizeof(hdr);
+    p->last_t = t0_ms;
+    p->count = 0;
+}
+
+bool rec_pack_add(struct rec_packer *p, const sample_rec_t *r)
+{
+    uint8_t rec[REC_MAX_ENC];
+    size_t n = 0;
+    bool is_signed = (r->type == REC_T_I16 || r->type == REC_T_CENTI);
+
+    rec[n++] = (r->stream << 4) | (r->type & 0x0f);
+    n += put_varint(&rec[n], zigzag((int32_t)(r->t_ms - p->last_t)));
+    n += put_varint(&rec[n], is_signed ? zigzag(r->value) : (uint16_t)r->value);
+
+    if (p->len + n > p->size) {
+        return false;
+    }
+    memcpy(&p->pkt[p->len], rec, n);
+    p->len += n;
+    p->last_t = r->t_ms;
+    p->count++;
+    return true;
+}
+
+void rec_pack_end(struct rec_packer *p)
+{
+    p->pkt[offsetof(rec_pkt_hdr_t, len)] = p->len;
+    memset(&p->pkt[p->len], 0, p->size - p->len);
+}
+
+size_t rec_encode_payload(rec_read_t read, void *arg, uint32_t first_seq,
+                          uint8_t *out, size_t cap, size_t pkt_size, uint32_t *records)
+{
+    struct rec_packer p;
+    sample_rec_t r;
+    size_t used = 0;
+    bool have = false;   // r was read but did not fit the last packet
+
+    *records = 0;
+    pkt_size = MIN(pkt_size, UINT8_MAX);
+    if (pkt_size < sizeof(rec_pkt_hdr_t) + REC_MAX_ENC) {
+        return 0;
+    }
+
+    while (used + pkt_size <= cap) {
+        if (!have && read(arg, (uint8_t *)&r, sizeof(r)) < (int)sizeof(r)) {
+            break;
+        }
+        have = false;
+
+        rec_pack_begin(&p, &out[used], pkt_size, first_seq + *records, r.t_ms);
+        rec_pack_add(&p, &r);
+        while (read(arg, (uint8_t *)&r, sizeof(r)) == sizeof(r)) {
+            if (!rec_pack_add(&p, &r)) {
+                have = true;
+                break;
+            }
+        }
+        rec_pack_end(&p);
+
+        used += pkt_size;
+        *records += p.count;
+        if (!have) {
+            break;
+        }
+    }
+    return used;
+}
@@ -0,0 +1,42 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "data.h"
+
+// Worst-case encoded record: tag, 5-byte time delta, 3-byte value
+#define REC_MAX_ENC 9
+
+// Builds one CODEC_RECORDS packet (rec_pkt_hdr_t + records) in place
+struct rec_packer {
+    uint8_t *pkt;
+    size_t   size;        // packet size, at most 255
+    size_t   len;         // bytes used
+    uint32_t last_t;      // time of the previous record
+    uint32_t count;       // records in the packet
+};
+
+// Start a packet for records numbered from first_seq.
+void rec_pack_begin(struct rec_packer *p, uint8_t *pkt, size_t size,
+                    uint32_t first_seq, uint32_t t0_ms);
+// Append r; false (nothing written) if it does not fit.
+bool rec_pack_add(struct rec_packer *p, const sample_rec_t *r);
+// Finish the packet: set its length and zero the padding.
+void rec_pack_end(struct rec_packer *p);
+
+// Pulls up to len bytes of log data into dst; returns the count.
+typedef int (*rec_read_t)(void *arg, uint8_t *dst, size_t len);
+
+/*
+ * Fill out[0..cap) with packets of pkt_size bytes holding the records
+ * read() returns, numbered from first_seq. Returns the bytes written
+ * (a multiple of pkt_size) and the records packed in *records. read() may
+ * have been asked for one record more than was packed.
+ */
+size_t rec_encode_payload(rec_read_t read, void *arg, uint32_t first_seq,
+                          uint8_t *out, size_t cap, size_t pkt_size, uint32_t *records);
+
+#endif // RECORD_H
@@ -0,0 +1,58 @@
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+#include "data.h"
+
+/*
+ * Lock-free single-producer/single-consumer ring of sample records.
+ * head is only written by the producer and tail only by the consumer;
+ * both run freely and are masked on access. The atomic stores order the
+ * record copy before the index update, so neither side ever waits.
+ */
+
+#define SAMPLE_RING_SIZE CONFIG_SENSOR_SAMPLE_RING_SIZE
+BUILD_ASSERT(IS_POWER_OF_TWO(SAMPLE_RING_SIZE), "ring size must be a power of two");
+
+struct sample_ring {
+    atomic_t head;        // next slot to write (producer)
+    atomic_t tail;        // next slot to read (consumer)
+    sample_rec_t recs[SAMPLE_RING_SIZE];
+};
+
+static inline uint32_t sample_ring_count(struct sample_ring *r)
+{
+    return (uint32_t)atomic_get(&r->head) - (uint32_t)atomic_get(&r->tail);
+}
+
+// Producer side. Returns false (and stores nothing) if the ring is full.
+static inline bool sample_ring_put(struct sample_ring *r, const sample_rec_t *rec)
+{
+    uint32_t head = atomic_get(&r->head);
+
+    if (head - (uint32_t)atomic_get(&r->tail) >= SAMPLE_RING_SIZE) {
+        return false;
+    }
+    r->recs[head & (SAMPLE_RING_SIZE - 1)] = *rec;
+    atomic_set(&r->head, head + 1);
+    return true;
+}
+
+// Consumer side. Copies up to max records into out, returns how many.
+static inline uint32_t sample_ring_get(struct sample_ring *r, sample_rec_t *out, uint32_t max)
+{
+    uint32_t tail = atomic_get(&r->tail);
+    uint32_t n = MIN((uint32_t)atomic_get(&r->head) - tail, max);
+
+    for (uint32_t i = 0; i < n; i++) {
+        out[i] = r->recs[(tail + i) & (SAMPLE_RING_SIZE - 1)];
+    }
+    atomic_set(&r->tail, tail + n);
+    return n;
+}
+
+#endif // SAMPLE_RING_H
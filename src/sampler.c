@@ -0,0 +1,116 @@
+/*
+ * Sampling: a cooperative thread wakes every CONFIG_SENSOR_SAMPLE_PERIOD_MS
+ * on a periodic timer, reads the sensor and pushes one record into an SPSC
+ * ring. It never waits on anything else, so BLE traffic or a busy system
+ * workqueue cannot delay a sample. The ring is drained in batches into the
+ * sensor log on the staging queue, where flash writes and erases may block
+ * without holding up the BT or system workqueue threads.
+ */
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+
+#include "data.h"
+#include "log_store.h"
+#include "sample_ring.h"
+#include "sampler.h"
+#include "hot_log.h"
+#include "sensor_logic.h"
+
+LOG_MODULE_DECLARE(peripheral_uart, CONFIG_NEBULA_LOG_LEVEL);
+
+static struct {
+    struct sample_ring ring;
+    struct k_timer timer;
+    struct k_work drain_work;
+    struct sampler_stats stats;
+    // stats.dropped, counted by both the sampler thread and stage_q
+    atomic_t dropped;
+    uint16_t seq;
+} M;
+
+K_THREAD_STACK_DEFINE(sampler_stack, CONFIG_SENSOR_SAMPLER_STACK_SIZE);
+static struct k_thread sampler_thread;
+
+// Read the sensor. Replace with the real driver; keep it non-blocking.
+static int16_t sample_acquire(void)
+{
+    // Demo: slow sawtooth so the series is easy to check on the mule
+    return (int16_t)(M.seq % 200) - 100;
+}
+
+static void drain_work_handler(struct k_work *work)
+{
+    sample_rec_t batch[CONFIG_SENSOR_SAMPLE_BATCH];
+    uint32_t n;
+
+    while ((n = sample_ring_get(&M.ring, batch, ARRAY_SIZE(batch))) > 0) {
+        int err = log_store_append(batch, n * sizeof(batch[0]));
+
+        if (err) {
+            HOT_LOG_WRN("%u samples not stored (err %d)", n, err);
+            atomic_add(&M.dropped, n);
+            continue;
+        }
+        M.stats.stored += n;
+    }
+
+    // New data: have the next payload staged if a buffer is free
+    sensor_stage_next();
+}
+
+static void sampler_thread_fn(void *p1, void *p2, void *p3)
+{
+    k_timeout_t period = K_MSEC(CONFIG_SENSOR_SAMPLE_PERIOD_MS);
+    int64_t due;
+
+    k_timer_start(&M.timer, period, period);
+    due = k_uptime_ticks();
+
+    for (;;) {
+        // Returns at once for ticks already missed; they are counted in 'due'
+        uint32_t ticks = k_timer_status_sync(&M.timer);
+        int64_t late;
+
+        due += (int64_t)ticks * period.ticks;
+        late = k_uptime_ticks() - due;
+        if (late > 0) {
+            M.stats.max_late_us = MAX(M.stats.max_late_us, k_ticks_to_us_floor32(late));
+        }
+
+        sample_rec_t rec = {
+            .t_ms   = k_uptime_get_32(),
+            .stream = 0,
+            .type   = REC_T_CENTI,
+            .value  = sample_acquire(),
+        };
+
+        M.seq++;
+        M.stats.samples++;
+        if (!sample_ring_put(&M.ring, &rec)) {
+            atomic_inc(&M.dropped);
+        }
+
+        // Only kick the consumer once per batch; the submit does not block.
+        if (sample_ring_count(&M.ring) >= CONFIG_SENSOR_SAMPLE_BATCH) {
+            sensor_stage_submit(&M.drain_work);
+        }
+    }
+}
+
+void sampler_init(void)
+{
+    k_timer_init(&M.timer, NULL, NULL);
+    k_work_init(&M.drain_work, drain_work_handler);
+
+    k_thread_create(&sampler_thread, sampler_stack, K_THREAD_STACK_SIZEOF(sampler_stack),
+                    sampler_thread_fn, NULL, NULL, NULL,
+                    K_PRIO_COOP(CONFIG_SENSOR_SAMPLER_PRIORITY), 0, K_NO_WAIT);
+    k_thread_name_set(&sampler_thread, "sampler");
+}
+
+void sampler_get_stats(struct sampler_stats *out)
+{
+    *out = M.stats;
+    out->dropped = atomic_get(&M.dropped);
+}
@@ -0,0 +1,18 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdint.h>
+
+// Sampling counters, kept by the sampling thread and the drain on stage_q
+struct sampler_stats {
+    uint32_t samples;       // records produced
+    uint32_t dropped;       // records lost: ring full or log append failed
+    uint32_t max_late_us;   // worst wake-up delay after a period tick
+    uint32_t stored;        // records drained into the sensor log
+};
+
+// Start the sampling thread and the drain work.
+void sampler_init(void);
+void sampler_get_stats(struct sampler_stats *out);
+
+#endif // SAMPLER_H
@@ -5,204 +5,1915 @@
 #include <zephyr/kernel.h>
 #include <string.h>
 #include <zephyr/logging/log.h>
-#include <zephyr/random/random.h>      // sys_csrand_get()
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/spinlock.h>
 #include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/l2cap.h>
+#include <zephyr/net_buf.h>
 #include <zephyr/bluetooth/services/nus.h> // Include NUS header
+#include <zephyr/settings/settings.h>
 
 #include "data.h"
-#include "aes_gcm.h"
+#include "aead.h"
 #include "sensor_logic.h"
+#include "conn_tuning.h"
+#include "crypto_session.h"
+#include "log_store.h"
+#include "payload.h"
+#include "metrics.h"
+#include "pacing.h"
+#include "trace.h"
+#include "hot_log.h"
+#include "cmd_parse.h"
+#include "chunk.h"
 
-// This is defined in main.c, declare it here to use it
-extern struct bt_conn *current_conn;
+LOG_MODULE_DECLARE(peripheral_uart, CONFIG_NEBULA_LOG_LEVEL);
 
-LOG_MODULE_DECLARE(peripheral_uart, LOG_LEVEL_INF);
+// Identity and progress of the payload being delivered
+struct resume_rec {
+    uint32_t token;       // CRC-32 of the payload bytes
+    uint32_t len;         // payload length
+    uint32_t delivered;   // payload bytes the mule(s) already hold
+};
 
-// ---- App state (replace sizes with your real max payload) ----
-static struct {
-    // Plaintext to protect (fill this with your real sensor bytes)
-    uint8_t  plaintext[2048];
-    size_t   plaintext_len;
+// Where payload chunks go. NUS always carries the commands.
+enum xfer_transport {
+    XFER_NUS,   // GATT notifications on the NUS TX characteristic
+    XFER_COC,   // SDUs on an LE credit-based L2CAP channel opened by the mule
+};
+
+// Life of a payload buffer. Only the stage work moves a buffer that is
+// not current out of IDLE/DONE, and only the current one is ever sent.
+enum payload_state {
+    PAYLOAD_IDLE,      // empty
+    PAYLOAD_STAGING,   // being filled (and encrypted)
+    PAYLOAD_READY,     // complete, nothing sent yet
+    PAYLOAD_SENDING,   // bytes frozen: at least one mule has pulled from it
+    PAYLOAD_DONE,      // fully delivered; free to stage again
+};
+
+// One payload and everything that describes it. Plaintext is written in
+// place (past the IV or frame overhead when encrypting) and encrypted in
+// place, so it is never copied between buffers: Encrypted payload =
+// IV || CT || TAG, or a run of AEAD frames with CONFIG_SENSOR_ENCRYPT_FRAMED
+struct payload_buf {
+    atomic_t state;       // enum payload_state
+    // Room for a windowed chunk header in front of chunk 0, see
+    // tx_send_seq(); must come right before data
+    uint8_t  headroom[sizeof(chunk_hdr_t)];
+    uint8_t  data[2048 + AEAD_IV_SIZE + AEAD_TAG_SIZE];
+    size_t   len;
+
+    // Identity and progress for RESUME
+    struct resume_rec resume;
 
-    // Encrypted payload = IV || CT || TAG
-    uint8_t  payload[2048 + AES_GCM_IV_SIZE + AES_GCM_TAG_SIZE];
-    size_t   payload_len;
+    // CODEC_RECORDS packet or AEAD frame size (0: not packetized);
+    // chunks then carry whole packets
+    size_t   pkt;
+#if defined(CONFIG_SENSOR_LOG)
+    // Taken from the sensor log: consumed there once delivered
+    bool     from_log;
+    struct log_cursor log_start; // log position of the first record
+    struct log_cursor log_end;   // log position just past the payload
+#endif
+#if defined(CONFIG_SENSOR_COMPRESS)
+    struct compress_report comp;
+#endif
+#if defined(CONFIG_SENSOR_ENCRYPT)
+    // Crypto IV (12 bytes)
+    uint8_t  iv[AEAD_IV_SIZE];
+    // Encrypts the payload in place, ahead of time when staged in the
+    // background, else chunk by chunk as it is sent
+    struct aead_stream aead;
+#endif
+};
 
-    // Transfer progress
-    size_t   off;
+// ---- Per-connection transfer context ----
+// One per possible link, indexed by bt_conn_index(). Each mule pulls the
+// shared payload at its own pace; the TX scheduler below serves all of them.
+struct xfer_ctx {
+    struct bt_conn *conn; // NULL when the slot is free
+
+    // Transfer progress, in chunks of chunk_size bytes starting at start_off
+    size_t   start_off;   // payload byte where this transfer began (RESUME)
+    size_t   chunk_size;  // payload bytes per chunk (excludes chunk_hdr_t)
+    uint16_t total;       // number of chunks
+    uint16_t next_seq;    // next chunk never sent before
     bool     running;
+    struct payload_buf *pb; // payload this transfer reads
+    atomic_t in_flight;   // chunks handed to the stack, not yet sent
+    // Transfer generation, carried by every chunk sent. Completions of an
+    // older transfer only free their share of the budget; those older than
+    // gen_base were written off when the link went down.
+    uint16_t gen;
+    uint16_t gen_base;
+    enum xfer_transport transport;
+
+    // Windowed mode (WSTART): the mule ACKs cumulatively and NACKs gaps.
+    // base/nack_mask are written from the command queue, so they sit under lock.
+    bool     windowed;
+    uint8_t  window;      // max chunks sent beyond base
+    uint16_t base;        // all chunks < base are acknowledged
+    uint32_t nack_mask;   // bit i set: chunk base+i must be resent
+    uint32_t last_progress_ms;
+    uint8_t  probes;      // timeouts since the last ACK that moved base
+    uint32_t retransmits;
+    uint32_t sent_chunks; // raw mode: chunks the stack reported as sent
+    struct k_spinlock lock;
 
     // Metadata (like the old code)
     meta_t   meta;
 
-    // Crypto IV (12 bytes)
-    uint8_t  iv[AES_GCM_IV_SIZE];
+    // Counters for the metrics history (no-ops without CONFIG_SENSOR_METRICS)
+    struct metrics_xfer metrics;
+    int64_t  cmd_t0;      // uptime ticks the command being run was dequeued
+
+    // How many chunks may be in flight on this link right now
+    struct pacer pace;
+
+#if defined(CONFIG_SENSOR_COC)
+    // L2CAP CoC bulk channel; the mule connects it to CONFIG_SENSOR_COC_PSM
+    struct bt_l2cap_le_chan coc;
+    bool     coc_connected;
+    bool     coc_wanted;  // COC requested, waiting for the mule's channel
+    int64_t  coc_t0;      // cmd_t0 of that COC command
+    // Starts the COC transfer on cmd_q: once the channel is up, or over
+    // NUS if it does not come up in time
+    struct k_work_delayable coc_start_work;
+#endif
+};
 
+// ---- App state (replace sizes with your real max payload) ----
+static struct {
+    // Two payload buffers shared by all connections, sent straight from
+    // here. Mules get S.buf[cur]; the other one is staged in the
+    // background meanwhile so the next contact can start right away.
+    struct payload_buf buf[2];
+    atomic_t cur;
+    struct k_mutex fill_lock;  // one payload filled at a time (codec state)
+    struct k_work stage_work;  // runs on stage_q
+    struct k_work cmd_work;    // runs on cmd_q
+
+    // Resume state of the current payload survives disconnects (and
+    // reboots with CONFIG_SENSOR_RESUME_PERSIST) so the next mule
+    // continues at 'delivered'.
+    struct k_work persist_work;
+
+#if defined(CONFIG_SENSOR_LOG)
+    bool     log_ready;
+#endif
+
+    // NUS TX characteristic value attribute, for bt_gatt_notify_cb()
+    const struct bt_gatt_attr *nus_tx_attr;
+
+    // TX scheduler shared by all contexts
+    struct xfer_ctx ctx[CONFIG_BT_MAX_CONN];
+    atomic_t in_flight;   // chunks in flight over all contexts
+    uint8_t  rr;          // context served first in the next round
     struct k_work_delayable tx_work;
 } S;
 
-// ---- Work handler to push chunks over NUS ----
-static void tx_work_handler(struct k_work *work)
+// NUS TX characteristic (6E400003-...). Resolved once at init so chunks can be
+// sent with bt_gatt_notify_cb() and we get a callback when each one has left.
+#define NUS_TX_CHAR_UUID \
+    BT_UUID_DECLARE_128(BT_UUID_128_ENCODE(0x6e400003, 0xb5a3, 0xf393, 0xe0a9, 0xe50e24dcca9e))
+
+// Largest NUS notification we build (ATT MTU 247 - 3 byte header)
+#define NUS_MAX_NOTIFY_LEN 244
+
+// Background staging runs below the BT and system workqueue threads, so
+// compressing and encrypting the next payload never delays a chunk.
+K_THREAD_STACK_DEFINE(stage_stack, CONFIG_SENSOR_STAGE_STACK_SIZE);
+static struct k_work_q stage_q;
+
+// Mule commands: NUS RX copies each write into cmd_msgq, and cmd_q runs
+// them, so the BT RX thread never waits for a payload to be prepared.
+struct cmd_msg {
+    struct bt_conn *conn; // referenced while queued
+    uint8_t  len;
+    uint8_t  data[CONFIG_SENSOR_CMD_MAX_LEN];
+};
+
+K_MSGQ_DEFINE(cmd_msgq, sizeof(struct cmd_msg), CONFIG_SENSOR_CMD_QUEUE_DEPTH, 4);
+K_THREAD_STACK_DEFINE(cmd_stack, CONFIG_SENSOR_CMD_STACK_SIZE);
+static struct k_work_q cmd_q;
+
+// Payload new transfers read
+static inline struct payload_buf *payload_cur(void)
 {
-    if (!S.running || !current_conn) {
-        return;
+    return &S.buf[atomic_get(&S.cur)];
+}
+
+// Payload staged while the current one is on air
+static inline struct payload_buf *payload_other(void)
+{
+    return &S.buf[!atomic_get(&S.cur)];
+}
+
+static struct xfer_ctx *ctx_of(struct bt_conn *conn)
+{
+    struct xfer_ctx *x = &S.ctx[bt_conn_index(conn)];
+
+    return (x->conn == conn) ? x : NULL;
+}
+
+// x's connection index, for trace records
+static inline uint8_t ctx_id(const struct xfer_ctx *x)
+{
+    return (uint8_t)(x - S.ctx);
+}
+
+static void transfer_begin(struct xfer_ctx *x, bool windowed, uint8_t window,
+                           size_t start_off, int64_t t0);
+
+// The first 'chunks' chunks of x's transfer have reached the mule.
+static void note_delivered(struct xfer_ctx *x, uint32_t chunks)
+{
+    struct payload_buf *pb = x->pb;
+    size_t done = MIN((size_t)chunks * x->chunk_size, pb->len - x->start_off);
+
+    pb->resume.delivered = MAX(pb->resume.delivered, x->start_off + done);
+}
+
+// x's transfer is over (XFER_OUT_*): file its metrics record.
+static void transfer_end(struct xfer_ctx *x, uint8_t outcome)
+{
+    uint32_t chunks = x->windowed ? x->base : x->sent_chunks;
+    size_t done = MIN((size_t)chunks * x->chunk_size, x->pb->len - x->start_off);
+
+    if (outcome == XFER_OUT_DONE) {
+        done = x->pb->len - x->start_off;
     }
+    metrics_xfer_pacing(&x->metrics, x->pace.per_event, pacer_window(&x->pace),
+                        x->pace.window_max, x->pace.backoffs);
+    metrics_xfer_end(&x->metrics, outcome, done);
+}
 
-    if (S.off >= S.payload_len) {
-        S.meta.ready = 2; // done
-        S.running = false;
-        LOG_INF("transfer complete (%u bytes)", (unsigned)S.payload_len);
+// What a chunk carries through the stack to its completion: context and
+// transfer generation
+#define TX_TAG(x)          (((uint32_t)(x)->gen << 8) | ctx_id(x))
+#define TX_TAG_CTX(tag)    (&S.ctx[(tag) & 0xffu])
+#define TX_TAG_GEN(tag)    ((uint16_t)((tag) >> 8))
+
+// One chunk sent for transfer generation 'gen' of x left the stack, on
+// whichever transport carried it.
+static void tx_chunk_done(struct xfer_ctx *x, uint16_t gen)
+{
+    // Already written off with the link it was sent on
+    if ((int16_t)(gen - x->gen_base) < 0) {
         return;
     }
 
-    // Dynamically calculate the chunk size based on the connection's actual MTU.
-    // This is the correct and robust way to handle data transmission.
-    // queries the actual, negotiated MTU for current_conn which will be sent by ESP32
-    uint16_t mtu = bt_gatt_get_mtu(current_conn);
-    size_t chunk_len = MIN(S.payload_len - S.off, mtu - 3);
+    if (atomic_dec(&x->in_flight) <= 0) {
+        atomic_set(&x->in_flight, 0);
+    }
+    trace_mark(TR_TX_DONE, ctx_id(x), (uint16_t)atomic_get(&x->in_flight));
+    if (atomic_dec(&S.in_flight) <= 0) {
+        atomic_set(&S.in_flight, 0);
+    }
 
-    int err = bt_nus_send(current_conn, &S.payload[S.off], chunk_len);
-    if (err) {
-        // If the error is ENOMEM (-12), it's a temporary buffer issue, so we can retry.
-        // Any other error (like -ENOTCONN) is fatal for this transfer.
-        if (err == -ENOMEM) {
-            LOG_WRN("bt_nus_send err %d (retry)", err);
-            k_work_reschedule(&S.tx_work, K_MSEC(5));
-        } else {
-            LOG_ERR("bt_nus_send fatal error %d, stopping transfer.", err);
-            // Stop the transfer immediately on a fatal error.
-            S.running = false;
+    // A chunk of a stopped or replaced transfer says nothing about this one
+    if (x->running && gen == x->gen) {
+        pacer_on_done(&x->pace);
+        // Raw mode has no ACKs: the best we know is what left the stack.
+        if (!x->windowed) {
+            note_delivered(x, ++x->sent_chunks);
         }
-        return;
     }
 
-    S.off += chunk_len;
+    // A buffer just freed up: refill the pipeline right away.
+    k_work_reschedule(&S.tx_work, K_NO_WAIT);
+}
+
+// ---- Send-complete callback: one notification left the stack ----
+static void tx_sent_cb(struct bt_conn *conn, void *user_data)
+{
+    uint32_t tag = POINTER_TO_UINT(user_data);
+
+    tx_chunk_done(TX_TAG_CTX(tag), TX_TAG_GEN(tag));
+}
+
+static int nus_send_chunk(struct xfer_ctx *x, const uint8_t *data, uint16_t len)
+{
+    struct bt_gatt_notify_params params = {
+        .attr      = S.nus_tx_attr,
+        .data      = data,
+        .len       = len,
+        .func      = tx_sent_cb,
+        .user_data = UINT_TO_POINTER(TX_TAG(x)),
+    };
+    int err;
+
+    trace_begin(TR_SEND, ctx_id(x), len);
+    err = bt_gatt_notify_cb(x->conn, &params);
+    trace_end(TR_SEND, ctx_id(x), (uint16_t)err);
+    return err;
+}
+
+#if defined(CONFIG_SENSOR_COC)
+static void coc_buf_destroy(struct net_buf *buf);
+
+// One SDU per chunk; the pool bounds how many are queued to the channels.
+// The payload bytes are copied once, from the payload buffer straight into
+// the SDU; the stack needs BT_L2CAP_SDU_CHAN_SEND_RESERVE of headroom in
+// front of them, so the SDU cannot point into the payload itself.
+NET_BUF_POOL_FIXED_DEFINE(coc_tx_pool, CONFIG_SENSOR_TX_BUDGET,
+                          BT_L2CAP_SDU_BUF_SIZE(CONFIG_SENSOR_COC_SDU_LEN),
+                          CONFIG_BT_CONN_TX_USER_DATA_SIZE, coc_buf_destroy);
+
+// TX_TAG() each queued pool buffer was sent with. Kept beside the pool rather than in buf->user_data, which belongs to the stack while
+// the SDU is queued.
+static struct {
+    bool     queued;
+    uint32_t tag;
+} coc_buf_owner[CONFIG_SENSOR_TX_BUDGET];
+
+// The stack released an SDU: it was sent, or dropped with the channel.
+// Either way the chunk is no longer in flight.
+static void coc_buf_destroy(struct net_buf *buf)
+{
+    bool queued = coc_buf_owner[net_buf_id(buf)].queued;
+    uint32_t tag = coc_buf_owner[net_buf_id(buf)].tag;
+
+    coc_buf_owner[net_buf_id(buf)].queued = false;
+    net_buf_destroy(buf);
+
+    if (queued) {
+        tx_chunk_done(TX_TAG_CTX(tag), TX_TAG_GEN(tag));
+    }
+}
+
+static int coc_send_chunk(struct xfer_ctx *x, const uint8_t *data, uint16_t len)
+{
+    struct net_buf *buf = net_buf_alloc(&coc_tx_pool, K_NO_WAIT);
+    int err;
+
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    net_buf_reserve(buf, BT_L2CAP_SDU_CHAN_SEND_RESERVE);
+    net_buf_add_mem(buf, data, len);
 
-    // Schedule the next chunk of data to be sent.
-    // A small delay here allows the CPU to sleep, saving power, since this handler uses busy waiting. 
-    // This also reduces the chance of hitting the "No ATT channel" race condition.
-    // K_MSEC(5) = 5 ms delay
-    k_work_reschedule(&S.tx_work, K_MSEC(5));
-    // INTENTIONAL DELAY HERE. REDUCE if higher throughput needed.
+    // Credits are handled by the stack; the SDU waits there if the mule has
+    // none left, and coc_buf_destroy() runs once it has been fully sent.
+    coc_buf_owner[net_buf_id(buf)].tag = TX_TAG(x);
+    coc_buf_owner[net_buf_id(buf)].queued = true;
+    trace_begin(TR_SEND, ctx_id(x), len);
+    err = bt_l2cap_chan_send(&x->coc.chan, buf);
+    trace_end(TR_SEND, ctx_id(x), (uint16_t)err);
+    if (err < 0) {
+        // Not queued: release it without counting a completion.
+        coc_buf_owner[net_buf_id(buf)].queued = false;
+        net_buf_unref(buf);
+        return err;
+    }
+    return 0;
 }
 
-// This new function will be called from main.c on disconnect.
-// handle race condition TX loops before disconnected callback, No ATT channel Error
-void sensor_stop_transfer(void)
+static void coc_connected(struct bt_l2cap_chan *chan)
 {
-    if (S.running) {
-        S.running = false;
-        // Cancel any pending work to ensure no more send attempts are made.
-        k_work_cancel_delayable(&S.tx_work);
-        LOG_INF("Transfer stopped due to disconnect.");
+    struct xfer_ctx *x = CONTAINER_OF(chan, struct xfer_ctx, coc.chan);
+
+    LOG_INF("CoC connected (tx MTU %u, MPS %u)", x->coc.tx.mtu, x->coc.tx.mps);
+    x->coc_connected = true;
+
+    // The mule sent COC before opening the channel: start now, on cmd_q
+    // like every other transfer start.
+    if (x->coc_wanted) {
+        k_work_reschedule_for_queue(&cmd_q, &x->coc_start_work, K_NO_WAIT);
     }
 }
 
-// Define the callbacks for the NUS service
-static struct bt_nus_cb nus_callbacks = {
-    .received = sensor_on_rx_cmd,
+static void coc_disconnected(struct bt_l2cap_chan *chan)
+{
+    struct xfer_ctx *x = CONTAINER_OF(chan, struct xfer_ctx, coc.chan);
+
+    LOG_INF("CoC disconnected");
+    x->coc_connected = false;
+    if (x->transport == XFER_COC && x->conn) {
+        sensor_stop_transfer(x->conn);
+        x->transport = XFER_NUS;
+    }
+}
+
+// Incoming SDUs are not used; the mule sends commands over NUS.
+static int coc_recv(struct bt_l2cap_chan *chan, struct net_buf *buf)
+{
+    return 0;
+}
+
+static const struct bt_l2cap_chan_ops coc_ops = {
+    .connected    = coc_connected,
+    .disconnected = coc_disconnected,
+    .recv         = coc_recv,
 };
 
-void sensor_init(void)
+static int coc_accept(struct bt_conn *conn, struct bt_l2cap_server *server,
+                      struct bt_l2cap_chan **chan)
+{
+    struct xfer_ctx *x = ctx_of(conn);
+
+    if (!x || x->coc.chan.conn) {
+        return -ENOMEM;
+    }
+
+    memset(&x->coc, 0, sizeof(x->coc));
+    x->coc.chan.ops = &coc_ops;
+    *chan = &x->coc.chan;
+    return 0;
+}
+
+static struct bt_l2cap_server coc_server = {
+    .psm       = CONFIG_SENSOR_COC_PSM,
+    .sec_level = BT_SECURITY_L1,
+    .accept    = coc_accept,
+};
+
+// The mule asked for COC: start over its channel, or over NUS if it never
+// opened one. Runs on cmd_q.
+static void coc_start_work_handler(struct k_work *work)
+{
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct xfer_ctx *x = CONTAINER_OF(dwork, struct xfer_ctx, coc_start_work);
+
+    if (!x->coc_wanted || !x->conn) {
+        return;
+    }
+    x->coc_wanted = false;
+    if (x->coc_connected) {
+        x->transport = XFER_COC;
+    } else {
+        LOG_WRN("no CoC from mule, falling back to NUS");
+        x->transport = XFER_NUS;
+    }
+    transfer_begin(x, false, 0, 0, x->coc_t0);
+}
+#endif // CONFIG_SENSOR_COC
+
+static inline size_t chunk_off_of(struct xfer_ctx *x, uint16_t seq)
+{
+    return chunk_off(x->start_off, x->chunk_size, seq);
+}
+
+static inline size_t chunk_len_of(struct xfer_ctx *x, uint16_t seq)
+{
+    return chunk_len(x->start_off, x->pb->len, x->chunk_size, seq);
+}
+
+// Pick the next chunk to put on air: gaps the mule NACKed first, then new
+// chunks as long as they fit in the window. Returns false if nothing is due.
+static bool tx_pick_seq(struct xfer_ctx *x, uint16_t *seq, bool *is_retx)
+{
+    k_spinlock_key_t key = k_spin_lock(&x->lock);
+    bool found = false;
+
+    if (x->windowed && x->nack_mask) {
+        uint32_t bit = u32_count_trailing_zeros(x->nack_mask);
+
+        x->nack_mask &= ~BIT(bit);
+        *seq = x->base + bit;
+        *is_retx = true;
+        found = true;
+    } else if (x->next_seq < x->total &&
+               (!x->windowed || x->next_seq < x->base + x->window)) {
+        *seq = x->next_seq++;
+        *is_retx = false;
+        found = true;
+    }
+
+    k_spin_unlock(&x->lock, key);
+    return found;
+}
+
+// Undo tx_pick_seq() after the stack refused the chunk.
+static void tx_unpick_seq(struct xfer_ctx *x, uint16_t seq, bool is_retx)
+{
+    k_spinlock_key_t key = k_spin_lock(&x->lock);
+
+    if (is_retx) {
+        if (seq >= x->base && seq - x->base < 32) {
+            x->nack_mask |= BIT(seq - x->base);
+        }
+    } else {
+        x->next_seq = seq;
+    }
+
+    k_spin_unlock(&x->lock, key);
+}
+
+BUILD_ASSERT(offsetof(struct payload_buf, data) ==
+             offsetof(struct payload_buf, headroom) + sizeof(chunk_hdr_t));
+
+// Windowed chunks go out as [chunk_hdr_t | bytes] without first copying
+// the bytes next to a header: the header is written over the
+// sizeof(chunk_hdr_t) payload bytes in front of the chunk (the headroom
+// for chunk 0), which are put back once the stack has copied the
+// notification. Only the TX work item reads a payload while it is being
+// sent, so nobody sees the patched bytes.
+static int nus_send_framed(struct xfer_ctx *x, uint16_t seq, uint8_t *src, uint16_t len)
 {
+    uint8_t *hdr = src - sizeof(chunk_hdr_t);
+    uint8_t saved[sizeof(chunk_hdr_t)];
     int err;
 
-    memset(&S, 0, sizeof(S));
-    k_work_init_delayable(&S.tx_work, tx_work_handler);
+    memcpy(saved, hdr, sizeof(saved));
+    chunk_hdr_put(hdr, seq, x->total);
+    err = nus_send_chunk(x, hdr, sizeof(chunk_hdr_t) + len);
+    memcpy(hdr, saved, sizeof(saved));
+    return err;
+}
 
-    // replaces bt_nus_init()
-    err = bt_nus_cb_register(&nus_callbacks, NULL);
-    if (err) {
-        LOG_ERR("Failed to initialize NUS service (err: %d)", err);
+static int tx_send_seq(struct xfer_ctx *x, uint16_t seq)
+{
+    uint8_t *src = (uint8_t *)x->pb + offsetof(struct payload_buf, data) + chunk_off_of(x, seq);
+    size_t len = chunk_len_of(x, seq);
+
+#if defined(CONFIG_SENSOR_ENCRYPT)
+    // Encrypt up to the end of this chunk right before it goes on air
+    // (nothing to do if it was staged). Ciphertext stays in the payload
+    // for resends and other mules.
+    size_t upto = chunk_off_of(x, seq) + len;
+    bool sealing = x->pb->aead.active;
+    psa_status_t status;
+
+    if (sealing) {
+        trace_begin(TR_SEAL, ctx_id(x), upto / 16);
+    }
+    status = aead_stream_seal(&x->pb->aead, upto);
+    if (sealing) {
+        trace_end(TR_SEAL, ctx_id(x), upto / 16);
+    }
+
+    if (status != PSA_SUCCESS) {
+        LOG_ERR("payload encryption failed (%d)", (int)status);
+        return -EIO;
     }
+#endif
+
+#if defined(CONFIG_SENSOR_COC)
+    if (x->transport == XFER_COC) {
+        return coc_send_chunk(x, src, len);
+    }
+#endif
+
+    if (!x->windowed) {
+        return nus_send_chunk(x, src, len);
+    }
+
+    return nus_send_framed(x, seq, src, len);
 }
 
-// Fill S.plaintext with your real data
-static void fill_plaintext_demo(void)
+// Nothing left to send in windowed mode but the window is not yet fully
+// acknowledged. If the mule stays quiet for CONFIG_SENSOR_ACK_TIMEOUT_MS,
+// resend the oldest unacknowledged chunk so it answers with ACK/NACK.
+// Returns 0 if a probe was queued, else the ms until the next check
+// (or -1 if the transfer was abandoned).
+static int32_t tx_ack_timeout(struct xfer_ctx *x)
 {
-    static const char demo[] = "NEBULA demo payload — replace with real sensor data";
-    memcpy(S.plaintext, demo, sizeof(demo));
-    S.plaintext_len = sizeof(demo);
+    k_spinlock_key_t key = k_spin_lock(&x->lock);
+    uint32_t elapsed = k_uptime_get_32() - x->last_progress_ms;
+    uint8_t probes = x->probes;
+    bool probe = false;
+
+    if (elapsed >= CONFIG_SENSOR_ACK_TIMEOUT_MS &&
+        probes < CONFIG_SENSOR_ACK_MAX_PROBES) {
+        x->probes++;
+        x->nack_mask |= BIT(0);
+        x->last_progress_ms = k_uptime_get_32();
+        probe = true;
+    }
+
+    k_spin_unlock(&x->lock, key);
+
+    if (probe) {
+        return 0;
+    }
+
+    if (elapsed >= CONFIG_SENSOR_ACK_TIMEOUT_MS) {
+        LOG_WRN("no ACK after %u probes, stopping transfer", probes);
+        x->running = false;
+        transfer_end(x, XFER_OUT_TIMEOUT);
+        return -1;
+    }
+    return CONFIG_SENSOR_ACK_TIMEOUT_MS - elapsed;
 }
 
-void sensor_prepare_payload(void)
+static void transfer_complete(struct xfer_ctx *x)
+{
+    x->meta.ready = 2; // done
+    x->running = false;
+    transfer_end(x, XFER_OUT_DONE);
+    if (x->windowed) {
+        LOG_INF("transfer complete (%u bytes, %u chunks resent)",
+                (unsigned)(x->pb->len - x->start_off), (unsigned)x->retransmits);
+    } else {
+        LOG_INF("transfer complete (%u bytes)",
+                (unsigned)(x->pb->len - x->start_off));
+    }
+    k_work_submit_to_queue(&stage_q, &S.persist_work);
+}
+
+// Outcome of giving one context a turn in the scheduler
+enum tx_turn {
+    TX_SENT,      // one chunk handed to the stack
+    TX_IDLE,      // nothing due right now
+    TX_NOMEM,     // stack out of buffers
+};
+
+// Send at most one chunk for x, if it has fewer than 'limit' in flight and
+// its pacing window allows. *wake_ms is lowered to the delay after which x
+// needs another turn even if no send completes (ACK timeout).
+static enum tx_turn tx_turn(struct xfer_ctx *x, atomic_val_t limit, int32_t *wake_ms)
 {
-    // 1) Fill plaintext
-    fill_plaintext_demo();
+    uint16_t seq;
+    bool is_retx;
+
+    if (!x->running || !x->conn) {
+        return TX_IDLE;
+    }
+
+    if (atomic_get(&x->in_flight) >= MIN(limit, pacer_window(&x->pace))) {
+        return TX_IDLE;
+    }
 
-    /* Comment out all encryption codes, send in plaintext
-    
-    // 2) Random IV (12 bytes). On Nordic DKs, sys_csrand_get() draws from HW entropy.
-    sys_csrand_get(S.iv, sizeof(S.iv));
+    while (!tx_pick_seq(x, &seq, &is_retx)) {
+        if (!x->windowed) {
+            // Everything queued; finish once the last chunk has gone out.
+            if (x->next_seq >= x->total && atomic_get(&x->in_flight) == 0) {
+                transfer_complete(x);
+            }
+            return TX_IDLE;
+        }
+
+        if (x->base >= x->total) {
+            transfer_complete(x);
+            return TX_IDLE;
+        }
+
+        // Window full or everything sent: wait for ACK/NACK, probe on silence.
+        if (atomic_get(&x->in_flight) != 0) {
+            return TX_IDLE;
+        }
+
+        int32_t wait = tx_ack_timeout(x);
 
-    // 3) Encrypt: output layout = IV || CT || TAG (your PSA-backed function)
-    encrypt_character_array(
-        //key (const uint8_t*)"\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0A\x0B\x0C\x0D\x0E\x0F",
-        //iv   S.iv,
-        //pt   S.plaintext,
-        //out  S.payload,
-        //len  S.plaintext_len
-    );
-    S.payload_len = AES_GCM_IV_SIZE + S.plaintext_len + AES_GCM_TAG_SIZE;
-    */
+        if (wait != 0) {
+            if (wait > 0 && (*wake_ms < 0 || wait < *wake_ms)) {
+                *wake_ms = wait;
+            }
+            return TX_IDLE;
+        }
+        // A probe was queued: pick it up
+    }
 
-    // Send plaintext directly without encryption
-    memcpy(S.payload, S.plaintext, S.plaintext_len);
-    S.payload_len = S.plaintext_len;
+    // Count it before sending: the completion may run before we return.
+    atomic_inc(&x->in_flight);
+    atomic_inc(&S.in_flight);
 
-    // 4) Init metadata like the old code
-    S.meta.num_chunks = (S.payload_len + CHUNK_SIZE - 1) / CHUNK_SIZE;
-    S.meta.chunks_rx  = 0;
-    S.meta.ready      = 1;   // “sending”
-    S.off             = 0;
+    int err = tx_send_seq(x, seq);
+    if (err) {
+        atomic_dec(&x->in_flight);
+        atomic_dec(&S.in_flight);
+        tx_unpick_seq(x, seq, is_retx);
+        // If the error is ENOMEM (-12), it's a temporary buffer issue, so we can retry.
+        // Any other error (like -ENOTCONN) is fatal for this transfer.
+        if (err == -ENOMEM) {
+            metrics_xfer_enomem(&x->metrics);
+            return TX_NOMEM;
+        }
+        LOG_ERR("bt_nus_send fatal error %d, stopping transfer.", err);
+        // Stop the transfer immediately on a fatal error.
+        x->running = false;
+        transfer_end(x, XFER_OUT_FAILED);
+        return TX_IDLE;
+    }
 
-    // logs to show plaintext being sent
-    LOG_INF("Payload to be sent: \"%.*s\"", (int)S.payload_len, S.payload);
+    metrics_xfer_sent(&x->metrics, chunk_len_of(x, seq), is_retx);
+    if (is_retx) {
+        x->retransmits++;
+    }
+    return TX_SENT;
 }
 
-void sensor_start_transfer(void)
+// ---- Work handler to push chunks to all connected mules ----
+// Round-robin over the contexts, one chunk per context per round, so every
+// mule gets an equal share of the stack's TX buffers. At most
+// CONFIG_SENSOR_TX_BUDGET chunks are in flight in total, and each context
+// at most its fair share of the budget and its pacing window (pacing.h).
+// The handler runs again from the send-complete callbacks, so there is no
+// fixed delay between chunks; the only timed retry is after -ENOMEM with
+// nothing of ours in flight (nothing would otherwise wake us up), one or
+// more connection events later as the pacer says.
+static void tx_schedule(void)
 {
-    if (!current_conn) {
-        LOG_WRN("no connection; cannot start transfer");
+    int32_t wake_ms = -1;
+    atomic_val_t limit;
+    size_t active = 0;
+    bool sent;
+
+    for (size_t i = 0; i < ARRAY_SIZE(S.ctx); i++) {
+        active += S.ctx[i].running;
+    }
+    if (active == 0) {
         return;
     }
-    if (S.payload_len == 0) {
-        sensor_prepare_payload();
+    limit = CLAMP(CONFIG_SENSOR_TX_BUDGET / active, 1, CONFIG_SENSOR_TX_PIPELINE_DEPTH);
+
+    do {
+        sent = false;
+        for (size_t i = 0; i < ARRAY_SIZE(S.ctx); i++) {
+            struct xfer_ctx *x = &S.ctx[(S.rr + i) % ARRAY_SIZE(S.ctx)];
+
+            if (atomic_get(&S.in_flight) >= CONFIG_SENSOR_TX_BUDGET) {
+                return;
+            }
+
+            switch (tx_turn(x, limit, &wake_ms)) {
+            case TX_SENT:
+                sent = true;
+                break;
+            case TX_NOMEM: {
+                k_timeout_t retry = pacer_on_nomem(&x->pace);
+
+                if (atomic_get(&S.in_flight) == 0) {
+                    HOT_LOG_DBG("bt_nus_send err %d (retry)", -ENOMEM);
+                    k_work_reschedule(&S.tx_work, retry);
+                }
+                // else: a send-complete callback will reschedule us.
+                S.rr = (S.rr + i + 1) % ARRAY_SIZE(S.ctx);
+                return;
+            }
+            case TX_IDLE:
+                break;
+            }
+        }
+        S.rr = (S.rr + 1) % ARRAY_SIZE(S.ctx);
+    } while (sent);
+
+    if (wake_ms > 0) {
+        k_work_reschedule(&S.tx_work, K_MSEC(wake_ms));
+    }
+}
+
+static void tx_work_handler(struct k_work *work)
+{
+    trace_begin(TR_TX_WORK, TRACE_NO_ID, 0);
+    tx_schedule();
+    trace_end(TR_TX_WORK, TRACE_NO_ID, (uint16_t)atomic_get(&S.in_flight));
+}
+
+// Called from main.c on connect: claim the link's transfer context.
+void sensor_conn_add(struct bt_conn *conn)
+{
+    struct xfer_ctx *x = &S.ctx[bt_conn_index(conn)];
+
+    x->conn = conn;
+    x->running = false;
+    x->transport = XFER_NUS;
+    atomic_set(&x->in_flight, 0);
+#if defined(CONFIG_SENSOR_COC)
+    x->coc_connected = false;
+    x->coc_wanted = false;
+#endif
+}
+
+// Called from main.c on disconnect: stop the link's transfer and free it.
+// Chunks still queued for the link will not be sent: write them off, and
+// move the generation on so their completions, if any, are ignored.
+void sensor_conn_remove(struct bt_conn *conn)
+{
+    struct xfer_ctx *x = ctx_of(conn);
+    k_spinlock_key_t key;
+
+    if (!x) {
+        return;
+    }
+    sensor_stop_transfer(conn);
+
+    key = k_spin_lock(&x->lock);
+    x->gen++;
+    x->gen_base = x->gen;
+    k_spin_unlock(&x->lock, key);
+    atomic_sub(&S.in_flight, atomic_set(&x->in_flight, 0));
+    if (atomic_get(&S.in_flight) < 0) {
+        atomic_set(&S.in_flight, 0);
     }
-    S.running = true;
+    x->conn = NULL;
+    // Give the remaining mules the freed share right away.
     k_work_reschedule(&S.tx_work, K_NO_WAIT);
 }
 
-// Very small command parser over NUS RX.
-// You can keep the old 3-byte metadata flow by having the central send “ACK”
-// after each chunk, or keep it simple: central sends “START”, we stream.
-void sensor_on_rx_cmd(struct bt_conn *conn, const uint8_t *data, uint16_t len)
+// Called on disconnect (via sensor_conn_remove) or when the CoC drops.
+// handle race condition TX loops before disconnected callback, No ATT channel Error
+void sensor_stop_transfer(struct bt_conn *conn)
 {
-    // The 'conn' parameter is unused in this case, but required by the signature.
-    // The (void)conn; cast prevents a compiler warning about an unused variable.
-    (void)conn;
+    struct xfer_ctx *x = ctx_of(conn);
 
-    if (len >= 5 && !memcmp(data, "START", 5)) {
-        LOG_INF("START received from central");
-        sensor_prepare_payload();
-        LOG_INF("payload prepared starting transfer");
-        sensor_start_transfer();
+    if (!x) {
         return;
     }
 
-    if (len >= 4 && !memcmp(data, "PREP", 4)) {
-        LOG_INF("PREP received from central");
-        sensor_prepare_payload();
+#if defined(CONFIG_SENSOR_COC)
+    x->coc_wanted = false;
+    k_work_cancel_delayable(&x->coc_start_work);
+#endif
+
+    if (x->running) {
+        // The scheduler skips contexts that are not running. Chunks still
+        // in the stack stay counted until they complete.
+        x->running = false;
+        // Link or CoC channel gone; the caller logs which
+        LOG_INF("Transfer stopped (%u/%u bytes delivered).",
+                (unsigned)x->pb->resume.delivered, (unsigned)x->pb->resume.len);
+        transfer_end(x, XFER_OUT_STOPPED);
+        k_work_submit_to_queue(&stage_q, &S.persist_work);
+    }
+}
+
+// ---- Resume state persistence ----
+#if defined(CONFIG_SENSOR_RESUME_PERSIST)
+// Last saved record, loaded by settings_load() at boot. It is only applied
+// when sensor_prepare_payload() regenerates a payload with the same token.
+static struct resume_rec saved_resume;
+
+static int resume_settings_set(const char *name, size_t len,
+                               settings_read_cb read_cb, void *cb_arg)
+{
+    if (strcmp(name, "resume") || len != sizeof(saved_resume)) {
+        return -ENOENT;
+    }
+
+    int rc = read_cb(cb_arg, &saved_resume, sizeof(saved_resume));
+
+    return (rc < 0) ? rc : 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(sensor, "sensor", NULL, resume_settings_set, NULL, NULL);
+#endif
+
+// Once pb has been fully delivered, mark it DONE and, if it came from the
+// sensor log, move the log's consumed mark past it so the next payload
+// starts with new data. Takes S.fill_lock: staging reads from_log and
+// log_end of the current payload.
+static void payload_release(struct payload_buf *pb)
+{
+    k_mutex_lock(&S.fill_lock, K_FOREVER);
+    if (atomic_get(&pb->state) != PAYLOAD_SENDING ||
+        pb->resume.delivered < pb->resume.len) {
+        k_mutex_unlock(&S.fill_lock);
         return;
     }
+#if defined(CONFIG_SENSOR_LOG)
+    if (pb->from_log) {
+        int err = log_store_consume(&pb->log_end);
 
-    // Optional: accept acknowledgments like the old metadata flow
-    // Example: "ACK <n>" increments S.meta.chunks_rx to <n>
-    if (len >= 3 && !memcmp(data, "ACK", 3)) {
-        // parse number after ACK if you want strict syncing
-        LOG_INF("ACK received from central");
+        if (err) {
+            LOG_WRN("sensor log mark not saved (err %d)", err);
+        }
+        pb->from_log = false;
+    }
+#endif
+    (void)atomic_cas(&pb->state, PAYLOAD_SENDING, PAYLOAD_DONE);
+    k_mutex_unlock(&S.fill_lock);
+}
+
+// Runs on stage_q so flash writes stay out of BT callbacks and off the
+// system workqueue that sends chunks, and so a staging fill holding
+// S.fill_lock never blocks it there.
+static void persist_work_handler(struct k_work *work)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(S.buf); i++) {
+        payload_release(&S.buf[i]);
+    }
+
+#if defined(CONFIG_SENSOR_RESUME_PERSIST)
+    struct resume_rec rec = payload_cur()->resume;
+    int err;
+
+    if (!memcmp(&rec, &saved_resume, sizeof(rec))) {
+        return;
+    }
+
+    err = settings_save_one("sensor/resume", &rec, sizeof(rec));
+    if (err) {
+        LOG_WRN("resume state not saved (err %d)", err);
         return;
     }
+    saved_resume = rec;
+#endif
+}
+
+bool sensor_transfer_pending(void)
+{
+    struct payload_buf *pb = payload_cur();
+
+    return pb->resume.len != 0 && pb->resume.delivered < pb->resume.len;
+}
+
+void sensor_backlog(struct sensor_backlog *b)
+{
+    struct payload_buf *pb = payload_cur();
+
+    *b = (struct sensor_backlog){ .resume = sensor_transfer_pending() };
+#if defined(CONFIG_SENSOR_LOG)
+    if (S.log_ready) {
+        size_t cap = log_store_capacity();
 
-    LOG_INF("RX cmd ignored (len=%u)", (unsigned)len);
+        // Payloads are cut from the log: its undelivered bytes cover them
+        b->pending = log_store_pending();
+        b->end_seq = log_store_end() / sizeof(sample_rec_t);
+        b->fill_pct = cap ? MIN((uint64_t)b->pending * 100 / cap, 100) : 0;
+        return;
+    }
+#endif
+    if (b->resume) {
+        b->pending = pb->resume.len - pb->resume.delivered;
+    }
+}
+
+// True while any mule is pulling the payload, which must then stay untouched.
+static bool payload_busy(void)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(S.ctx); i++) {
+        if (S.ctx[i].running) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void stage_work_handler(struct k_work *work);
+static void cmd_work_handler(struct k_work *work);
+
+// Define the callbacks for the NUS service
+static struct bt_nus_cb nus_callbacks = {
+    .received = sensor_on_rx_cmd,
+};
+
+void sensor_init(void)
+{
+    int err;
+
+    memset(&S, 0, sizeof(S));
+    k_work_init_delayable(&S.tx_work, tx_work_handler);
+    k_work_init(&S.persist_work, persist_work_handler);
+    k_work_init(&S.stage_work, stage_work_handler);
+    k_mutex_init(&S.fill_lock);
+
+    k_work_queue_start(&stage_q, stage_stack, K_THREAD_STACK_SIZEOF(stage_stack),
+                       CONFIG_SENSOR_STAGE_PRIORITY,
+                       &(const struct k_work_queue_config){ .name = "stage" });
+    k_work_init(&S.cmd_work, cmd_work_handler);
+    k_work_queue_start(&cmd_q, cmd_stack, K_THREAD_STACK_SIZEOF(cmd_stack),
+                       CONFIG_SENSOR_CMD_PRIORITY,
+                       &(const struct k_work_queue_config){ .name = "cmd" });
+
+#if defined(CONFIG_SENSOR_COC)
+    for (size_t i = 0; i < ARRAY_SIZE(S.ctx); i++) {
+        k_work_init_delayable(&S.ctx[i].coc_start_work, coc_start_work_handler);
+    }
+    err = bt_l2cap_server_register(&coc_server);
+    if (err) {
+        LOG_ERR("Failed to register L2CAP server (err: %d)", err);
+    }
+#endif
+
+#if defined(CONFIG_SENSOR_ENCRYPT)
+    err = crypto_session_init();
+    if (err) {
+        LOG_ERR("crypto session unavailable (err %d)", err);
+    }
+#endif
+
+#if defined(CONFIG_SENSOR_LOG)
+    err = log_store_init();
+    if (err) {
+        // Sampled data has nowhere to go: this is a configuration error
+        LOG_ERR("sensor log unavailable (err %d), using demo payload", err);
+    }
+    S.log_ready = (err == 0);
+#endif
+
+    S.nus_tx_attr = bt_gatt_find_by_uuid(NULL, 0, NUS_TX_CHAR_UUID);
+    if (!S.nus_tx_attr) {
+        LOG_ERR("NUS TX characteristic not found");
+    }
+
+    // replaces bt_nus_init()
+    err = bt_nus_cb_register(&nus_callbacks, NULL);
+    if (err) {
+        LOG_ERR("Failed to initialize NUS service (err: %d)", err);
+    }
+}
+
+// Write the plaintext (your real sensor bytes) to dst, return its length
+static size_t fill_plaintext_demo(uint8_t *dst, size_t cap)
+{
+    static const char demo[] = "NEBULA demo payload — replace with real sensor data";
+    size_t len = MIN(sizeof(demo), cap);
+
+    memcpy(dst, demo, len);
+    return len;
+}
+
+#if defined(CONFIG_SENSOR_LOG)
+// Cursor at the log position 'from' (NULL: the consumed mark), moved past
+// any overwritten blocks. False if nothing is stored from there on.
+static bool log_cursor_from(const struct log_cursor *from, struct log_cursor *c)
+{
+    if (!S.log_ready) {
+        return false;
+    }
+
+    if (from) {
+        *c = *from;
+    } else {
+        log_store_cursor(c);
+    }
+    if (c->pos >= log_store_end()) {
+        return false;
+    }
+
+    (void)log_store_read(c, NULL, 0);
+    return true;
+}
+
+// Cursor at the first log record pb will carry. False if there is nothing
+// to send.
+static bool log_payload_cursor(struct payload_buf *pb, const struct log_cursor *from,
+                               struct log_cursor *c)
+{
+    pb->from_log = false;
+    if (!log_cursor_from(from, c)) {
+        return false;
+    }
+
+    pb->log_start = *c;
+    return true;
+}
+#endif
+
+#if defined(CONFIG_SENSOR_COMPRESS_RECORDS)
+#define PAYLOAD_CODEC   CODEC_RECORDS
+#define PAYLOAD_REC_PKT CONFIG_SENSOR_REC_PACKET_SIZE
+#elif defined(CONFIG_SENSOR_COMPRESS)
+#define PAYLOAD_CODEC \
+    (IS_ENABLED(CONFIG_SENSOR_COMPRESS_LZSS) ? CODEC_LZSS : CODEC_DELTA_LZSS)
+#else
+#define PAYLOAD_CODEC   CODEC_NONE
+#endif
+#ifndef PAYLOAD_REC_PKT
+#define PAYLOAD_REC_PKT 0
+#endif
+
+// AEAD frame size, 0 for one stream (see aead_payload_begin())
+#if defined(CONFIG_SENSOR_ENCRYPT_FRAMED)
+#define PAYLOAD_FRAME CONFIG_SENSOR_AEAD_FRAME_SIZE
+#else
+#define PAYLOAD_FRAME 0
+#endif
+
+#if defined(CONFIG_SENSOR_LOG)
+// payload_src over the sensor log
+struct log_src {
+    struct log_cursor at;
+    struct log_cursor start;
+};
+
+static int log_src_read(void *arg, uint8_t *dst, size_t len)
+{
+    struct log_src *ls = arg;
+
+    return log_store_read(&ls->at, dst, len);
+}
+
+static void log_src_rewind(void *arg)
+{
+    struct log_src *ls = arg;
+
+    ls->at = ls->start;
+}
+
+// Encode the log records from 'from' on into dst, return the length.
+// Returns 0 if there are none or they cannot be read.
+static size_t fill_log(struct payload_buf *pb, const struct log_cursor *from,
+                       uint8_t *dst, size_t cap)
+{
+    static const struct payload_codec codec = {
+        .codec   = PAYLOAD_CODEC,
+        .framed  = IS_ENABLED(CONFIG_SENSOR_COMPRESS),
+        .rec_pkt = PAYLOAD_REC_PKT,
+    };
+    struct log_src ls;
+    struct payload_src src = {
+        .read   = log_src_read,
+        .rewind = log_src_rewind,
+        .arg    = &ls,
+    };
+    struct payload_enc enc;
+    int err;
+
+    if (!log_payload_cursor(pb, from, &ls.start)) {
+        return 0;
+    }
+    ls.at = ls.start;
+    src.first_seq = ls.start.pos / sizeof(sample_rec_t);
+
+    err = payload_encode(&src, &codec, dst, cap, &enc);
+    if (err || enc.raw_len == 0) {
+        LOG_WRN("sensor log read failed (err %d)", err);
+        return 0;
+    }
+
+    pb->log_end.pos = ls.start.pos + enc.raw_len;
+    pb->from_log = true;
+    pb->pkt = enc.pkt;
+    if (enc.records) {
+        LOG_INF("packed %u records into %u bytes (%u.%02u bytes/record)",
+                enc.records, (unsigned)enc.len, (unsigned)(enc.len / enc.records),
+                (unsigned)((enc.len * 100 / enc.records) % 100));
+    }
+#if defined(CONFIG_SENSOR_COMPRESS)
+    if (enc.comp.out_len) {
+        pb->comp = enc.comp;
+        LOG_INF("compressed %u -> %u bytes (%u.%02u:1) in %u us",
+                enc.comp.raw_len, enc.comp.out_len, enc.comp.raw_len / enc.comp.out_len,
+                (enc.comp.raw_len * 100 / enc.comp.out_len) % 100,
+                k_cyc_to_us_floor32(enc.comp.cycles));
+    }
+#endif
+    return enc.len;
+}
+#endif // CONFIG_SENSOR_LOG
+
+// Write the plaintext to dst, return its length: the sensor log from
+// 'from' on, or the demo bytes while it is empty or not available. With
+// compression every payload starts with comp_hdr_t telling the mule how
+// to decode it.
+static size_t fill_plaintext(struct payload_buf *pb, const struct log_cursor *from,
+                             uint8_t *dst, size_t cap)
+{
+    size_t hdr = IS_ENABLED(CONFIG_SENSOR_COMPRESS) ? sizeof(comp_hdr_t) : 0;
+    size_t n;
+
+    pb->pkt = 0;
+#if defined(CONFIG_SENSOR_LOG)
+    n = fill_log(pb, from, dst, cap);
+    if (n > 0) {
+        return n;
+    }
+#endif
+
+    n = fill_plaintext_demo(dst + hdr, cap - hdr);
+#if defined(CONFIG_SENSOR_COMPRESS)
+    comp_hdr_t h = { .codec = CODEC_NONE, .raw_len = sys_cpu_to_le32(n) };
+
+    memcpy(dst, &h, sizeof(h));
+#endif
+    return hdr + n;
+}
+
+// Log the payload's size; its plaintext only at debug level, as a hex dump
+// of the start (no string formatting, and cheap with dictionary logging).
+static void payload_log(struct payload_buf *pb, const uint8_t *pt, size_t pt_len)
+{
+#if defined(CONFIG_SENSOR_LOG)
+    if (pb->from_log) {
+        LOG_INF("Payload to be sent: %u bytes from the sensor log", (unsigned)pt_len);
+        return;
+    }
+#endif
+#if defined(CONFIG_SENSOR_COMPRESS)
+    pt += sizeof(comp_hdr_t);
+    pt_len -= sizeof(comp_hdr_t);
+#endif
+    LOG_INF("Payload to be sent: %u bytes", (unsigned)pt_len);
+    LOG_HEXDUMP_DBG(pt, MIN(pt_len, 64), "payload start");
+}
+
+// Fill pb with the payload that starts at log position 'from' (NULL: the
+// consumed mark) and set up its encryption; with 'seal', encrypt all of it
+// now rather than chunk by chunk as it is sent. The caller holds
+// S.fill_lock and has pb in PAYLOAD_STAGING. Returns 0 or -errno.
+static int payload_fill(struct payload_buf *pb, const struct log_cursor *from, bool seal)
+{
+    uint8_t *pt;
+    size_t pt_len;
+
+    trace_begin(TR_PREP, TRACE_NO_ID, 0);
+
+#if defined(CONFIG_SENSOR_ENCRYPT)
+    psa_status_t status;
+    uint32_t nonces;
+    int err;
+
+    // Abandon the previous payload's stream before its bytes are replaced
+    aead_stream_abort(&pb->aead);
+
+    // 1) Fill plaintext in place, where the ciphertext will go. Framed, it
+    //    sits far enough in that the frames written from the start of the
+    //    buffer never overtake plaintext still to be read.
+    size_t pt_off = aead_payload_pt_off(sizeof(pb->data), PAYLOAD_FRAME);
+
+    pt = &pb->data[pt_off];
+    pt_len = fill_plaintext(pb, from, pt, aead_payload_pt_max(sizeof(pb->data), PAYLOAD_FRAME));
+    pb->len = aead_payload_len(pt_len, PAYLOAD_FRAME);
+    // Framed, chunks carry whole frames so each one can be checked on its
+    // own; else the IV shifts record packets off chunk boundaries
+    pb->pkt = PAYLOAD_FRAME;
+    nonces = aead_payload_nonces(pt_len, PAYLOAD_FRAME);
+    payload_log(pb, pt, pt_len);
+
+    // 2) Next counter nonce (12 bytes), one per frame: no entropy draw, no
+    //    flash write except once per CONFIG_SENSOR_NONCE_BLOCK nonces.
+    err = crypto_session_next_nonce(pb->iv, nonces);
+
+    // 3) Start the stream with the session key: output layout =
+    //    IV || CT || TAG, or frames. Unless sealed here, tx_send_seq()
+    //    seals each chunk just before it goes on air, so the first chunk
+    //    leaves without waiting for the rest.
+    if (!err) {
+        trace_begin(TR_SEAL, TRACE_NO_ID, 0);
+        status = aead_payload_begin(&pb->aead, crypto_session_key(), pb->iv, pb->data,
+                                    sizeof(pb->data), pt_len, PAYLOAD_FRAME);
+        if (status == PSA_SUCCESS && seal) {
+            status = aead_stream_seal(&pb->aead, pb->len);
+        }
+        trace_end(TR_SEAL, TRACE_NO_ID, seal ? pb->len / 16 : 0);
+        if (status != PSA_SUCCESS) {
+            LOG_ERR("payload encryption failed (%d)", (int)status);
+            err = -EIO;
+        }
+    }
+    if (err) {
+        LOG_ERR("payload encryption setup failed (err %d)", err);
+        pb->len = 0;
+        memset(&pb->resume, 0, sizeof(pb->resume));
+        trace_end(TR_PREP, TRACE_NO_ID, 0);
+        return err;
+    }
+#else
+    // 1) Send plaintext directly without encryption: fill it in place
+    ARG_UNUSED(seal);
+    pt = pb->data;
+    pt_len = fill_plaintext(pb, from, pt, sizeof(pb->data));
+    pb->len = pt_len;
+    payload_log(pb, pt, pt_len);
+#endif
+
+    // 2) Identity for RESUME: the same bytes give the same token, so a
+    //    payload regenerated after a reboot picks up the saved progress.
+    //    Encrypted payloads hash IV and plaintext, so they never match
+    //    after a reboot (the IV is new and so is every ciphertext byte).
+#if defined(CONFIG_SENSOR_ENCRYPT)
+    pb->resume.token     = crc32_ieee_update(crc32_ieee(pb->iv, sizeof(pb->iv)), pt, pt_len);
+#else
+    pb->resume.token     = crc32_ieee(pt, pt_len);
+#endif
+    pb->resume.len       = pb->len;
+    pb->resume.delivered = 0;
+#if defined(CONFIG_SENSOR_RESUME_PERSIST)
+    if (saved_resume.token == pb->resume.token && saved_resume.len == pb->resume.len) {
+        pb->resume.delivered = saved_resume.delivered;
+    }
+#endif
+    trace_end(TR_PREP, TRACE_NO_ID, pb->len / 16);
+    return 0;
+}
+
+// True if the staged payload pb is what must be sent next from log
+// position 'from' (NULL: the consumed mark). It stops being so when the
+// payload it was staged to follow was not delivered after all, or when
+// the log filled up while pb only held the demo bytes.
+static bool payload_starts_at(struct payload_buf *pb, const struct log_cursor *from)
+{
+#if defined(CONFIG_SENSOR_LOG)
+    struct log_cursor c;
+
+    if (!log_cursor_from(from, &c)) {
+        return !pb->from_log;
+    }
+    return pb->from_log && pb->log_start.pos == c.pos;
+#else
+    return true;
+#endif
+}
+
+// Background staging: fill and encrypt the buffer that is not current with
+// the payload that follows the current one, so the next contact can send
+// it at once. Runs on stage_q.
+static void stage_work_handler(struct k_work *work)
+{
+    struct payload_buf *cur, *pb;
+    const struct log_cursor *from = NULL;
+    uint32_t t0 = k_cycle_get_32();
+    int err;
+
+    k_mutex_lock(&S.fill_lock, K_FOREVER);
+    cur = payload_cur();
+    pb = payload_other();
+
+    // Already staged (or the only copy of a payload a mule may still want)
+    if (!atomic_cas(&pb->state, PAYLOAD_IDLE, PAYLOAD_STAGING) &&
+        !atomic_cas(&pb->state, PAYLOAD_DONE, PAYLOAD_STAGING)) {
+        k_mutex_unlock(&S.fill_lock);
+        return;
+    }
+
+#if defined(CONFIG_SENSOR_LOG)
+    struct log_cursor c;
+
+    // Continue after the current payload unless the log already moved past it
+    if (cur->from_log) {
+        from = &cur->log_end;
+    }
+    // Nothing new yet: stay free until the sampler adds data
+    if (S.log_ready && !log_cursor_from(from, &c)) {
+        atomic_set(&pb->state, PAYLOAD_IDLE);
+        k_mutex_unlock(&S.fill_lock);
+        return;
+    }
+#else
+    ARG_UNUSED(cur);
+#endif
+
+    err = payload_fill(pb, from, true);
+    atomic_set(&pb->state, err ? PAYLOAD_IDLE : PAYLOAD_READY);
+    k_mutex_unlock(&S.fill_lock);
+
+    if (!err) {
+        LOG_INF("next payload staged: %u bytes in %u us", (unsigned)pb->len,
+                k_cyc_to_us_floor32(k_cycle_get_32() - t0));
+    }
+}
+
+void sensor_stage_next(void)
+{
+    k_work_submit_to_queue(&stage_q, &S.stage_work);
+}
+
+void sensor_stage_submit(struct k_work *work)
+{
+    k_work_submit_to_queue(&stage_q, work);
+}
+
+// Make the payload that starts at 'from' (NULL: the consumed mark) current:
+// the staged one if it fits, else one filled right now. Its encryption then
+// runs chunk by chunk as it is sent. No mule may be reading the current one.
+static void payload_advance(const struct log_cursor *from)
+{
+    struct payload_buf *cur = payload_cur();
+    struct payload_buf *next = payload_other();
+
+    // The completion may not have been processed by persist_work yet
+    payload_release(cur);
+
+    k_mutex_lock(&S.fill_lock, K_FOREVER);
+    if (atomic_get(&next->state) == PAYLOAD_READY && payload_starts_at(next, from)) {
+        atomic_set(&S.cur, next - S.buf);
+        atomic_set(&cur->state, PAYLOAD_IDLE);
+        LOG_INF("sending staged payload (%u bytes)", (unsigned)next->len);
+    } else {
+        // A stale staged payload holds records that are due in this one
+        (void)atomic_cas(&next->state, PAYLOAD_READY, PAYLOAD_IDLE);
+
+        atomic_set(&cur->state, PAYLOAD_STAGING);
+        atomic_set(&cur->state, payload_fill(cur, from, false) ? PAYLOAD_IDLE : PAYLOAD_READY);
+    }
+    k_mutex_unlock(&S.fill_lock);
+
+    // Stage the one after it while this one is on air
+    sensor_stage_next();
+}
+
+void sensor_prepare_payload(void)
+{
+    // Another mule is reading the payload: keep it stable until it is done,
+    // and get the next one ready in the background meanwhile.
+    if (payload_busy()) {
+        LOG_WRN("payload in use by another transfer, staging the next one");
+        sensor_stage_next();
+        return;
+    }
+
+    payload_advance(NULL);
+}
+
+#if defined(CONFIG_SENSOR_LOG)
+// Prepare a payload of the log records from sequence number 'seq' on; the
+// mule already holds everything before it. Returns 0, -EBUSY while another
+// mule reads the payload, or -ENODATA if nothing newer is stored.
+static int prepare_since(uint32_t seq)
+{
+    struct log_cursor from = { .pos = seq * sizeof(sample_rec_t) };
+
+    if (payload_busy()) {
+        return -EBUSY;
+    }
+    if (!S.log_ready || from.pos >= log_store_end()) {
+        return -ENODATA;
+    }
+
+    payload_advance(&from);
+    return payload_cur()->from_log ? 0 : -ENODATA;
+}
+#endif
+
+// Split the payload into chunks that fit one notification on x's link.
+static void transfer_reset(struct xfer_ctx *x, bool windowed, uint8_t window,
+                           size_t start_off)
+{
+    // Chunk size follows the MTU negotiated at connect (cached by conn_tuning)
+    size_t room = MIN(conn_tuning_mtu(x->conn) - 3, NUS_MAX_NOTIFY_LEN);
+    k_spinlock_key_t key;
+
+#if defined(CONFIG_SENSOR_COC)
+    // L2CAP is reliable end to end: one SDU per chunk, no sequence header
+    if (x->transport == XFER_COC) {
+        room = MIN(CONFIG_SENSOR_COC_SDU_LEN, x->coc.tx.mtu);
+        windowed = false;
+    }
+#endif
+
+    if (windowed) {
+        room -= sizeof(chunk_hdr_t);
+    }
+
+    // Whole record packets or AEAD frames per chunk, so each one can be
+    // decoded or verified alone
+    if (x->pb->pkt && room >= x->pb->pkt) {
+        room = ROUND_DOWN(room, x->pb->pkt);
+    }
+
+    key = k_spin_lock(&x->lock);
+    x->windowed = windowed;
+    x->window = CLAMP(window, 1, 32);
+    x->start_off = start_off;
+    x->chunk_size = room;
+    x->total = chunk_count(x->pb->len - start_off, room);
+    x->next_seq = 0;
+    x->base = 0;
+    x->nack_mask = 0;
+    x->probes = 0;
+    x->retransmits = 0;
+    x->sent_chunks = 0;
+    x->last_progress_ms = k_uptime_get_32();
+    k_spin_unlock(&x->lock, key);
+
+    // Init metadata like the old code
+    x->meta.num_chunks = x->total;
+    x->meta.chunks_rx  = 0;
+    x->meta.ready      = 1;   // “sending”
+}
+
+// Start a transfer for x, asked for by a command dequeued at uptime ticks
+// t0. Runs on cmd_q, like every command: the only other user of a
+// context's transfer state is tx_work, which is stopped for x before
+// anything changes.
+static void transfer_begin(struct xfer_ctx *x, bool windowed, uint8_t window,
+                           size_t start_off, int64_t t0)
+{
+    struct payload_buf *pb = payload_cur();
+    struct k_work_sync sync;
+    bool was_running;
+    k_spinlock_key_t key;
+
+    if (pb->len == 0) {
+        sensor_prepare_payload();
+        pb = payload_cur();
+    }
+
+    // Take x out of the scheduler and wait for a TX turn that may already
+    // be sending from it. Completions can still reschedule tx_work, but
+    // it skips x from now on. Chunks of the earlier transfer still in the
+    // stack keep their share of the budget until they complete; the new
+    // generation keeps them out of this transfer's progress.
+    key = k_spin_lock(&x->lock);
+    was_running = x->running;
+    x->running = false;
+    x->gen++;
+    k_spin_unlock(&x->lock, key);
+    k_work_cancel_delayable_sync(&S.tx_work, &sync);
+
+    if (was_running) {
+        transfer_end(x, XFER_OUT_STOPPED);
+    }
+    // From the first chunk on the payload's bytes must not change
+    x->pb = pb;
+    (void)atomic_cas(&pb->state, PAYLOAD_READY, PAYLOAD_SENDING);
+    transfer_reset(x, windowed, window, start_off);
+    pacer_start(&x->pace, x->conn, x->chunk_size + (x->windowed ? sizeof(chunk_hdr_t) : 0));
+    metrics_xfer_begin(&x->metrics, x->conn,
+                       x->transport == XFER_COC ? 2 : (windowed ? 1 : 0), t0);
+    x->running = true;
+    k_work_reschedule(&S.tx_work, K_NO_WAIT);
+}
+
+void sensor_start_transfer(struct bt_conn *conn)
+{
+    struct xfer_ctx *x = ctx_of(conn);
+
+    if (!x) {
+        LOG_WRN("no connection; cannot start transfer");
+        return;
+    }
+    x->transport = XFER_NUS;
+    // Only command handlers start transfers
+    transfer_begin(x, false, 0, 0, x->cmd_t0);
+}
+
+// Cumulative ACK: the mule holds every chunk below 'next'.
+static void on_ack(struct xfer_ctx *x, uint32_t next)
+{
+    k_spinlock_key_t key = k_spin_lock(&x->lock);
+
+    if (next > x->base && next <= x->next_seq) {
+        uint32_t shift = next - x->base;
+
+        x->nack_mask = (shift >= 32) ? 0 : (x->nack_mask >> shift);
+        x->base = next;
+        x->probes = 0;
+    }
+    x->last_progress_ms = k_uptime_get_32();
+    x->meta.chunks_rx = x->base;
+    note_delivered(x, x->base);
+    k_spin_unlock(&x->lock, key);
+}
+
+// Selective NACK: the mule is missing chunk 'seq'.
+static void on_nack(struct xfer_ctx *x, uint32_t seq)
+{
+    k_spinlock_key_t key = k_spin_lock(&x->lock);
+
+    if (seq >= x->base && seq < x->next_seq && seq - x->base < 32) {
+        x->nack_mask |= BIT(seq - x->base);
+    }
+    x->last_progress_ms = k_uptime_get_32();
+    k_spin_unlock(&x->lock, key);
+}
+
+// ---- Mule commands ----
+// One command being run: its connection, its arguments in binary form, and
+// whether it came as text (replies then are text too).
+struct cmd_call {
+    struct xfer_ctx *x;
+    const uint8_t *arg;
+    uint8_t  len;
+    bool     text;
+};
+
+// Send a binary reply [op | len | body] on NUS TX.
+static void send_reply(struct bt_conn *conn, uint8_t op, const void *body, uint8_t len)
+{
+    uint8_t buf[2 + sizeof(cmd_status_rsp_t)];
+
+    __ASSERT_NO_MSG(len <= sizeof(buf) - 2);
+    buf[0] = op;
+    buf[1] = len;
+    memcpy(&buf[2], body, len);
+
+    int err = bt_nus_send(conn, buf, 2 + len);
+    if (err) {
+        HOT_LOG_WRN("reply 0x%02x failed (err %d)", op, err);
+    }
+}
+
+// Reply "PENDING <token> <delivered> <len>" or "IDLE" on NUS TX, or
+// cmd_status_rsp_t to a binary command.
+static void send_status(const struct cmd_call *c)
+{
+    cmd_status_rsp_t rsp = { 0 };
+    char line[40];
+    int n;
+
+    if (sensor_transfer_pending()) {
+        struct resume_rec *r = &payload_cur()->resume;
+
+        rsp.pending = 1;
+        rsp.a = sys_cpu_to_le32(r->token);
+        rsp.b = sys_cpu_to_le32(r->delivered);
+        rsp.c = sys_cpu_to_le32(r->len);
+        n = snprintk(line, sizeof(line), "PENDING %08x %u %u",
+                     r->token, r->delivered, r->len);
+    } else {
+#if defined(CONFIG_SENSOR_LOG)
+        struct log_cursor cur;
+
+        log_store_cursor(&cur);
+        rsp.a = sys_cpu_to_le32(cur.pos / sizeof(sample_rec_t));
+        rsp.b = sys_cpu_to_le32(log_store_end() / sizeof(sample_rec_t));
+        n = snprintk(line, sizeof(line), "IDLE %u %u",
+                     (unsigned)(cur.pos / sizeof(sample_rec_t)),
+                     (unsigned)(log_store_end() / sizeof(sample_rec_t)));
+#else
+        n = snprintk(line, sizeof(line), "IDLE");
+#endif
+    }
+
+    if (!c->text) {
+        send_reply(c->x->conn, CMD_STATUS, &rsp, sizeof(rsp));
+        return;
+    }
+
+    int err = bt_nus_send(c->x->conn, line, n);
+    if (err) {
+        HOT_LOG_WRN("status reply failed (err %d)", err);
+    }
+}
+
+#if defined(CONFIG_SENSOR_LOG)
+// Reply "SYNC <first> <end>" (the payload carries records [first, end))
+// or "BUSY" on NUS TX, or cmd_sync_rsp_t to a binary command.
+static void send_sync(const struct cmd_call *c, int rc)
+{
+    cmd_sync_rsp_t rsp = { .status = CMD_SYNC_OK };
+    uint32_t first = 0, last = 0;
+    char line[32];
+    int n;
+
+    if (rc == -EBUSY) {
+        rsp.status = CMD_SYNC_BUSY;
+        n = snprintk(line, sizeof(line), "BUSY");
+    } else {
+        if (rc == 0) {
+            struct payload_buf *pb = payload_cur();
+
+            first = pb->log_start.pos / sizeof(sample_rec_t);
+            last  = pb->log_end.pos / sizeof(sample_rec_t);
+        } else {
+            rsp.status = CMD_SYNC_NODATA;
+            first = last = log_store_end() / sizeof(sample_rec_t);
+        }
+        n = snprintk(line, sizeof(line), "SYNC %u %u", first, last);
+    }
+
+    if (!c->text) {
+        rsp.first = sys_cpu_to_le32(first);
+        rsp.end   = sys_cpu_to_le32(last);
+        send_reply(c->x->conn, CMD_SYNC, &rsp, sizeof(rsp));
+        return;
+    }
+
+    int err = bt_nus_send(c->x->conn, line, n);
+    if (err) {
+        HOT_LOG_WRN("sync reply failed (err %d)", err);
+    }
+}
+#endif
+
+// Start windowed unless the command left the window out
+static void begin_optional_window(struct xfer_ctx *x, const struct cmd_call *c,
+                                  size_t at, size_t start_off)
+{
+    x->transport = XFER_NUS;
+    if (c->len > at) {
+        transfer_begin(x, true, MIN(c->arg[at], 32), start_off, x->cmd_t0);
+    } else {
+        transfer_begin(x, false, 0, start_off, x->cmd_t0);
+    }
+}
+
+static void cmd_start(const struct cmd_call *c)
+{
+    LOG_INF("START received from central");
+    // Keep an undelivered payload so its token stays valid for RESUME
+    if (!sensor_transfer_pending()) {
+        sensor_prepare_payload();
+    }
+    LOG_INF("payload prepared starting transfer");
+    sensor_start_transfer(c->x->conn);
+}
+
+static void cmd_wstart(const struct cmd_call *c)
+{
+    uint8_t window = c->len ? c->arg[0] : CONFIG_SENSOR_TX_WINDOW;
+
+    LOG_INF("WSTART received from central (window %u)", window);
+    if (!sensor_transfer_pending()) {
+        sensor_prepare_payload();
+    }
+    c->x->transport = XFER_NUS;
+    transfer_begin(c->x, true, MIN(window, 32), 0, c->x->cmd_t0);
+}
+
+static void cmd_status(const struct cmd_call *c)
+{
+    send_status(c);
+}
+
+static void cmd_resume(const struct cmd_call *c)
+{
+    struct payload_buf *pb = payload_cur();
+    uint32_t token = sys_get_le32(&c->arg[0]);
+    uint32_t off = sys_get_le32(&c->arg[4]);
+
+    if (token != pb->resume.token || off > pb->len) {
+        LOG_WRN("RESUME %08x@%u does not match payload %08x",
+                token, off, pb->resume.token);
+        send_status(c);
+        return;
+    }
+    LOG_INF("RESUME at %u/%u", off, (unsigned)pb->len);
+    begin_optional_window(c->x, c, 8, off);
+}
+
+static void cmd_sync(const struct cmd_call *c)
+{
+    uint32_t seq = sys_get_le32(&c->arg[0]);
+
+    LOG_INF("SYNC %u received from central", seq);
+#if defined(CONFIG_SENSOR_LOG)
+    // Positions are 32-bit byte offsets: larger watermarks are unknown
+    int rc = prepare_since(MIN(seq, UINT32_MAX / sizeof(sample_rec_t)));
+
+    send_sync(c, rc);
+    if (rc) {
+        return;
+    }
+    begin_optional_window(c->x, c, 4, 0);
+#else
+    LOG_WRN("sensor log not built in, SYNC ignored");
+    send_status(c);
+#endif
+}
+
+static void cmd_coc(const struct cmd_call *c)
+{
+    struct xfer_ctx *x = c->x;
+
+    LOG_INF("COC received from central");
+    if (!sensor_transfer_pending()) {
+        sensor_prepare_payload();
+    }
+#if defined(CONFIG_SENSOR_COC)
+    if (x->coc_connected) {
+        x->transport = XFER_COC;
+        transfer_begin(x, false, 0, 0, x->cmd_t0);
+    } else {
+        // Give the mule a moment to open the channel, else use NUS
+        x->transport = XFER_NUS;
+        x->coc_wanted = true;
+        x->coc_t0 = x->cmd_t0;
+        k_work_reschedule_for_queue(&cmd_q, &x->coc_start_work,
+                                    K_MSEC(CONFIG_SENSOR_COC_CONNECT_TIMEOUT_MS));
+    }
+#else
+    LOG_WRN("CoC support not built in, using NUS");
+    sensor_start_transfer(x->conn);
+#endif
+}
+
+static void cmd_prep(const struct cmd_call *c)
+{
+    ARG_UNUSED(c);
+    LOG_INF("PREP received from central");
+    sensor_prepare_payload();
+}
+
+static void cmd_nack(const struct cmd_call *c)
+{
+    for (size_t i = 0; i + 2 <= c->len; i += 2) {
+        on_nack(c->x, sys_get_le16(&c->arg[i]));
+    }
+    k_work_reschedule(&S.tx_work, K_NO_WAIT);
+}
+
+// ACK <n> moves meta.chunks_rx to <n>, like the old metadata flow
+static void cmd_ack(const struct cmd_call *c)
+{
+    if (c->len < 4) {
+        LOG_INF("ACK received from central");
+        return;
+    }
+    on_ack(c->x, sys_get_le32(c->arg));
+    k_work_reschedule(&S.tx_work, K_NO_WAIT);
+}
+
+// TRACE prints the hot-path trace ring on the console (see trace.h)
+static void cmd_trace(const struct cmd_call *c)
+{
+#if defined(CONFIG_SENSOR_TRACE)
+    trace_dump();
+#else
+    LOG_INF("TRACE: built without CONFIG_SENSOR_TRACE");
+#endif
+}
+
+// Handler of every command; the text and binary syntax is in cmd_parse.c.
+// Each connected mule has its own transfer context, so commands only
+// affect the mule that sent them.
+static const struct cmd_handler {
+    uint8_t op;
+    void (*fn)(const struct cmd_call *c);
+} cmd_handlers[] = {
+    { CMD_START,  cmd_start  },
+    { CMD_STATUS, cmd_status },
+    { CMD_RESUME, cmd_resume },
+    { CMD_SYNC,   cmd_sync   },
+    { CMD_WSTART, cmd_wstart },
+    { CMD_COC,    cmd_coc    },
+    { CMD_PREP,   cmd_prep   },
+    { CMD_TRACE,  cmd_trace  },
+    { CMD_NACK,   cmd_nack   },
+    { CMD_ACK,    cmd_ack    },
+};
+
+// Run one binary command [op | len | args].
+static void cmd_dispatch(struct xfer_ctx *x, const uint8_t *cmd, bool text)
+{
+    const struct cmd_syntax *syn = cmd_syntax_of(cmd[0]);
+
+    if (!syn) {
+        HOT_LOG_INF("RX cmd 0x%02x ignored", cmd[0]);
+        return;
+    }
+    if (cmd[1] < syn->min_len) {
+        HOT_LOG_WRN("%s needs %u argument bytes", syn->name, syn->min_len);
+        return;
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(cmd_handlers); i++) {
+        if (cmd_handlers[i].op == cmd[0]) {
+            trace_begin(TR_CMD, ctx_id(x), cmd[0]);
+            cmd_handlers[i].fn(&(const struct cmd_call){
+                .x = x, .arg = &cmd[2], .len = cmd[1], .text = text });
+            trace_end(TR_CMD, ctx_id(x), cmd[0]);
+            return;
+        }
+    }
+}
+
+// Run every command of one write from x's mule.
+static void cmd_process(struct xfer_ctx *x, const uint8_t *data, size_t len)
+{
+    uint8_t cmd[2 + CONFIG_SENSOR_CMD_MAX_LEN];
+    size_t n;
+
+    if (data[0] & 0x80) {
+        // Binary: commands back to back
+        while (len >= 2) {
+            n = 2 + data[1];
+            if (n > len) {
+                HOT_LOG_WRN("command 0x%02x cut short (%u of %u bytes)",
+                        data[0], (unsigned)len, (unsigned)n);
+                return;
+            }
+            cmd_dispatch(x, data, false);
+            data += n;
+            len -= n;
+        }
+        return;
+    }
+
+    n = cmd_from_text(data, len, cmd, sizeof(cmd));
+    if (n == 0) {
+        HOT_LOG_INF("RX cmd ignored (len=%u)", (unsigned)len);
+        return;
+    }
+    cmd_dispatch(x, cmd, true);
+}
+
+// Commands are run on cmd_q, in order, so the BT RX thread only copies them.
+static void cmd_work_handler(struct k_work *work)
+{
+    struct cmd_msg msg;
+
+    while (k_msgq_get(&cmd_msgq, &msg, K_NO_WAIT) == 0) {
+        struct xfer_ctx *x = ctx_of(msg.conn);
+
+        // The mule may have left while its commands were queued
+        if (x) {
+            // Transfer metrics count from here, before any payload is prepared
+            x->cmd_t0 = k_uptime_ticks();
+            cmd_process(x, msg.data, msg.len);
+        }
+        bt_conn_unref(msg.conn);
+    }
+}
+
+// NUS RX: queue the write for cmd_q and return at once.
+void sensor_on_rx_cmd(struct bt_conn *conn, const uint8_t *data, uint16_t len)
+{
+    struct cmd_msg msg;
+
+    if (len == 0) {
+        return;
+    }
+    if (len > sizeof(msg.data)) {
+        HOT_LOG_WRN("command write too long (%u bytes), dropped", len);
+        return;
+    }
+
+    msg.conn = bt_conn_ref(conn);
+    msg.len = len;
+    memcpy(msg.data, data, len);
+    if (k_msgq_put(&cmd_msgq, &msg, K_NO_WAIT)) {
+        HOT_LOG_WRN("command queue full, write dropped");
+        bt_conn_unref(msg.conn);
+        return;
+    }
+    k_work_submit_to_queue(&cmd_q, &S.cmd_work);
 }
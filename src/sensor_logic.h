@@ -1,14 +1,36 @@
 #ifndef SENSOR_LOGIC_H
 #define SENSOR_LOGIC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <zephyr/kernel.h>
 #include <zephyr/bluetooth/conn.h>
 
 void sensor_init(void);
 void sensor_prepare_payload(void);
-void sensor_start_transfer(void);
-void sensor_stop_transfer(void);
+// Fill and encrypt the next payload in the background if a buffer is free
+// (e.g. after new sensor data was logged).
+void sensor_stage_next(void);
+// Run work on the staging queue, below the BT and system workqueue threads
+// (e.g. flash writes that may stall on an erase).
+void sensor_stage_submit(struct k_work *work);
+// Claim / release the transfer context of a connected mule
+void sensor_conn_add(struct bt_conn *conn);
+void sensor_conn_remove(struct bt_conn *conn);
+void sensor_start_transfer(struct bt_conn *conn);
+void sensor_stop_transfer(struct bt_conn *conn);
+// True while a prepared payload has not been fully delivered (RESUME possible)
+bool sensor_transfer_pending(void);
+
+// What a mule would find here, for the advertising data
+struct sensor_backlog {
+    uint32_t pending;     // bytes not delivered yet
+    uint32_t end_seq;     // sequence number of the next record (0 without the log)
+    uint8_t  fill_pct;    // undelivered share of the sensor log, 0..100
+    bool     resume;      // sensor_transfer_pending()
+};
+void sensor_backlog(struct sensor_backlog *b);
 void sensor_on_rx_cmd(struct bt_conn *conn, const uint8_t *data, uint16_t len);
 
 #endif // SENSOR_LOGIC_H
\ No newline at end of file
@@ -0,0 +1,67 @@
+/*
+ * Hot-path trace ring and its console dump (see trace.h). The dump format,
+ * read by tools/nebula_trace.py:
+ *
+ *   # trace v1 hz=<cycles per second> n=<records> lost=<overwritten>
+ *   T <cyc:8 hex> <ev:2 hex> <id:2 hex> <arg:4 hex>    (n lines, oldest first)
+ *   # trace end
+ */
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#if defined(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+#endif
+
+#include "trace.h"
+
+struct trace_ring trace_ring;
+
+void trace_dump(void)
+{
+    atomic_val_t head;
+    size_t n;
+
+    // Printing takes far longer than the ring lasts under load: stop
+    // recording so the oldest records are not overwritten mid-dump.
+    trace_ring.paused = true;
+    head = atomic_get(&trace_ring.head);
+    n = MIN((size_t)head, (size_t)CONFIG_SENSOR_TRACE_ENTRIES);
+
+    printk("# trace v1 hz=%u n=%u lost=%u\n", sys_clock_hw_cycles_per_sec(),
+           (unsigned)n, (unsigned)(head - n));
+    for (size_t i = head - n; i < (size_t)head; i++) {
+        const struct trace_rec *r = &trace_ring.rec[i & (CONFIG_SENSOR_TRACE_ENTRIES - 1)];
+
+        printk("T %08x %02x %02x %04x\n", r->cyc, r->ev, r->id, r->arg);
+    }
+    printk("# trace end\n");
+    trace_ring.paused = false;
+}
+
+void trace_clear(void)
+{
+    atomic_set(&trace_ring.head, 0);
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_trace_dump(const struct shell *sh, size_t argc, char **argv)
+{
+    trace_dump();
+    return 0;
+}
+
+static int cmd_trace_clear(const struct shell *sh, size_t argc, char **argv)
+{
+    trace_clear();
+    shell_print(sh, "trace cleared");
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_trace,
+    SHELL_CMD(dump, NULL, "Print the trace ring for tools/nebula_trace.py", cmd_trace_dump),
+    SHELL_CMD(clear, NULL, "Forget every trace record", cmd_trace_clear),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(trace, &sub_trace, "Hot-path trace", cmd_trace_dump);
+#endif // CONFIG_SHELL
@@ -0,0 +1,88 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+/*
+ * Hot-path trace: each trace point stores (cycle counter, event, context,
+ * argument) into a fixed RAM ring; trace_dump() prints it on the console
+ * for tools/nebula_trace.py, which rebuilds a timeline and per-stage
+ * latency histograms. A trace point costs an atomic increment, a cycle
+ * counter read and one 8-byte store. Without CONFIG_SENSOR_TRACE the trace
+ * points are empty inline functions and the ring does not exist.
+ */
+
+// Events. Stages are traced as a begin/end pair (the end has TRACE_END
+// set); the others are single marks.
+enum trace_ev {
+    TR_TX_WORK = 1, // tx_work_handler() run
+    TR_SEND,        // one chunk handed to the stack; arg length, end arg error
+    TR_SEAL,        // payload encryption step; arg end offset / 16
+    TR_CMD,         // one mule command; arg opcode
+    TR_PREP,        // payload preparation; end arg payload length / 16
+    TR_TX_DONE,     // a chunk left the stack; arg chunks still in flight
+    TR_CONN,        // mule connected
+    TR_DISCONN,     // mule disconnected; arg HCI reason
+};
+
+#define TRACE_END   0x80u
+#define TRACE_NO_ID 0xffu   // event not tied to a connection
+
+struct trace_rec {
+    uint32_t cyc;         // k_cycle_get_32()
+    uint8_t  ev;          // enum trace_ev, | TRACE_END
+    uint8_t  id;          // connection index or TRACE_NO_ID
+    uint16_t arg;
+};
+
+#if defined(CONFIG_SENSOR_TRACE)
+struct trace_ring {
+    atomic_t head;        // records ever written; the ring holds the last ones
+    bool     paused;      // set while dumping
+    struct trace_rec rec[CONFIG_SENSOR_TRACE_ENTRIES];
+};
+
+extern struct trace_ring trace_ring;
+
+BUILD_ASSERT(IS_POWER_OF_TWO(CONFIG_SENSOR_TRACE_ENTRIES),
+             "CONFIG_SENSOR_TRACE_ENTRIES must be a power of two");
+
+static inline void trace_put(uint8_t ev, uint8_t id, uint16_t arg)
+{
+    struct trace_rec *r;
+
+    if (trace_ring.paused) {
+        return;
+    }
+    r = &trace_ring.rec[atomic_inc(&trace_ring.head) & (CONFIG_SENSOR_TRACE_ENTRIES - 1)];
+    *r = (struct trace_rec){ .cyc = k_cycle_get_32(), .ev = ev, .id = id, .arg = arg };
+}
+
+// Print the ring, oldest first, as lines for tools/nebula_trace.py.
+void trace_dump(void);
+// Forget every record.
+void trace_clear(void);
+#else
+static inline void trace_put(uint8_t ev, uint8_t id, uint16_t arg) {}
+static inline void trace_dump(void) {}
+static inline void trace_clear(void) {}
+#endif
+
+static inline void trace_begin(enum trace_ev ev, uint8_t id, uint16_t arg)
+{
+    trace_put(ev, id, arg);
+}
+
+static inline void trace_end(enum trace_ev ev, uint8_t id, uint16_t arg)
+{
+    trace_put(ev | TRACE_END, id, arg);
+}
+
+static inline void trace_mark(enum trace_ev ev, uint8_t id, uint16_t arg)
+{
+    trace_put(ev, id, arg);
+}
+
+#endif // TRACE_H
@@ -0,0 +1,36 @@
+#!/usr/bin/env bash
+#
+# Build the BabbleSim throughput test images into ${BSIM_OUT_PATH}/bin:
+#   bs_nrf52_bsim_nebula_sensor        the application, with sensor.conf
+#   bs_nrf52_bsim_nebula_mule_mtu<N>   the stand-in mule, ATT MTU <N>
+#
+# Needs ZEPHYR_BASE, BSIM_OUT_PATH and BSIM_COMPONENTS_PATH as for
+# Zephyr's own tests/bsim. MULE_MTUS overrides the MTU list.
+#
+set -eu
+
+: "${ZEPHYR_BASE:?ZEPHYR_BASE must be set}"
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must be set}"
+
+here=$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)
+app_root=$(cd "${here}/../.." && pwd)
+work=${WORK_DIR:-${here}/_build}
+bin=${BSIM_OUT_PATH}/bin
+mtus=${MULE_MTUS:-"23 65 247"}
+
+mkdir -p "${bin}"
+
+build() {
+    local src=$1 name=$2
+    shift 2
+    west build -b nrf52_bsim -d "${work}/${name}" -p auto "${src}" -- "$@"
+    cp "${work}/${name}/zephyr/zephyr.exe" "${bin}/bs_nrf52_bsim_${name}"
+}
+
+build "${app_root}" nebula_sensor -DEXTRA_CONF_FILE="${here}/sensor.conf"
+
+for mtu in ${mtus}; do
+    build "${here}/mule" "nebula_mule_mtu${mtu}" \
+        -DCONFIG_BT_L2CAP_TX_MTU="${mtu}" \
+        -DCONFIG_BT_BUF_ACL_RX_SIZE=$((mtu + 4))
+done
@@ -0,0 +1,318 @@
+/*
+ * Stand-in mule for the BabbleSim throughput test. Connects to the sensor
+ * with the connection interval and PHY given on the command line, finds
+ * NUS, prepares a payload (PREP, then STATUS for its length), sends START
+ * and reassembles the raw notification stream. A payload shorter than
+ * min_bytes fails the run. When the last byte is in it prints one result
+ * line for tests/bsim/throughput.sh:
+ *
+ *   MULE_RESULT mtu=<att mtu> interval=<1.25 ms units> phy=<1|2|4>
+ *       bytes=<payload> ttfb_us=<START to first chunk>
+ *       complete_ms=<START to last byte> goodput=<bytes per second>
+ *
+ * Times are simulated time, so they do not depend on the host.
+ */
+#include <zephyr/kernel.h>
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/uuid.h>
+
+#include "bs_types.h"
+#include "bs_cmd_line.h"
+#include "bs_dynargs.h"
+#include "posix_native_task.h"
+#include "posix_board_if.h"
+
+#include "data.h"
+
+#define NUS_UUID_VAL(n) BT_UUID_128_ENCODE(0x6e400000 + (n), 0xb5a3, 0xf393, 0xe0a9, 0xe50e24dcca9e)
+#define BT_UUID_NUS_SVC BT_UUID_DECLARE_128(NUS_UUID_VAL(1))
+#define BT_UUID_NUS_RX  BT_UUID_DECLARE_128(NUS_UUID_VAL(2))
+#define BT_UUID_NUS_TX  BT_UUID_DECLARE_128(NUS_UUID_VAL(3))
+
+static struct {
+    // Command line
+    uint32_t interval;    // connection interval, 1.25 ms units
+    uint32_t phy;         // BT_GAP_LE_PHY_1M / _2M / _CODED
+    uint32_t settle_s;    // sensor log age before connecting
+    uint32_t min_bytes;   // smallest payload the sweep point accepts
+
+    struct bt_conn *conn;
+    uint16_t rx_handle;   // NUS RX value (commands)
+    uint16_t tx_handle;   // NUS TX value (notifications)
+    struct bt_gatt_discover_params disc;
+    struct bt_gatt_discover_params ccc_disc;
+    struct bt_gatt_subscribe_params sub;
+
+    // Transfer
+    bool     streaming;   // after START: notifications are payload
+    uint32_t len;         // payload length from STATUS
+    uint32_t got;
+    int64_t  t_start;     // uptime ticks when START was written
+    int64_t  t_first;
+
+    struct k_sem connected;
+    struct k_sem step;    // discovery, subscription or STATUS done
+    struct k_sem done;
+} M = {
+    .interval = 24,
+    .phy = BT_GAP_LE_PHY_2M,
+};
+
+static bs_args_struct_t mule_args[] = {
+    { .option = "interval", .name = "units", .type = 'u', .dest = &M.interval,
+      .descript = "connection interval in 1.25 ms units (default 24)" },
+    { .option = "phy", .name = "phy", .type = 'u', .dest = &M.phy,
+      .descript = "PHY: 1 (1M), 2 (2M, default) or 4 (coded)" },
+    { .option = "settle_s", .name = "s", .type = 'u', .dest = &M.settle_s,
+      .descript = "seconds of sensor sampling before connecting (payload size)" },
+    { .option = "min_bytes", .name = "bytes", .type = 'u', .dest = &M.min_bytes,
+      .descript = "fail if the payload is shorter than this (default 0)" },
+    ARG_TABLE_ENDMARKER
+};
+
+static void mule_register_args(void)
+{
+    bs_add_extra_dynargs(mule_args);
+}
+NATIVE_TASK(mule_register_args, PRE_BOOT_1, 1);
+
+static void fail(const char *what, int err)
+{
+    printk("MULE_FAIL %s (err %d)\n", what, err);
+    posix_exit(1);
+}
+
+static uint8_t on_notify(struct bt_conn *conn, struct bt_gatt_subscribe_params *params,
+                         const void *data, uint16_t length)
+{
+    const uint8_t *p = data;
+
+    if (!data) {
+        return BT_GATT_ITER_STOP;
+    }
+    if (!M.streaming) {
+        // Command replies: [op | len | body]
+        if (length >= 2 + sizeof(cmd_status_rsp_t) && p[0] == CMD_STATUS) {
+            const cmd_status_rsp_t *rsp = (const void *)&p[2];
+
+            M.len = rsp->pending ? sys_le32_to_cpu(rsp->c) : 0;
+            k_sem_give(&M.step);
+        }
+        return BT_GATT_ITER_CONTINUE;
+    }
+
+    if (M.got == 0) {
+        M.t_first = k_uptime_ticks();
+    }
+    M.got += length;
+    if (M.got >= M.len) {
+        M.streaming = false;
+        k_sem_give(&M.done);
+    }
+    return BT_GATT_ITER_CONTINUE;
+}
+
+static uint8_t on_discover(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                           struct bt_gatt_discover_params *params)
+{
+    if (attr) {
+        const struct bt_gatt_chrc *chrc = attr->user_data;
+
+        if (!bt_uuid_cmp(params->uuid, BT_UUID_NUS_RX)) {
+            M.rx_handle = chrc->value_handle;
+        } else {
+            M.tx_handle = chrc->value_handle;
+        }
+    }
+    k_sem_give(&M.step);
+    return BT_GATT_ITER_STOP;
+}
+
+static void discover(const struct bt_uuid *uuid)
+{
+    int err;
+
+    M.disc = (struct bt_gatt_discover_params){
+        .uuid = uuid,
+        .func = on_discover,
+        .start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE,
+        .end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE,
+        .type = BT_GATT_DISCOVER_CHARACTERISTIC,
+    };
+    err = bt_gatt_discover(M.conn, &M.disc);
+    if (err) {
+        fail("discovery", err);
+    }
+    k_sem_take(&M.step, K_FOREVER);
+}
+
+static void on_subscribed(struct bt_conn *conn, uint8_t err,
+                          struct bt_gatt_subscribe_params *params)
+{
+    if (err) {
+        fail("subscribe", err);
+    }
+    k_sem_give(&M.step);
+}
+
+static void write_cmd(uint8_t op)
+{
+    const uint8_t cmd[2] = { op, 0 };
+    int err = bt_gatt_write_without_response(M.conn, M.rx_handle, cmd, sizeof(cmd), false);
+
+    if (err) {
+        fail("command write", err);
+    }
+}
+
+static void connected(struct bt_conn *conn, uint8_t err)
+{
+    if (err) {
+        fail("connect", err);
+    }
+    k_sem_give(&M.connected);
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+    if (M.streaming) {
+        fail("disconnected mid-transfer", reason);
+    }
+}
+
+// Keep the swept interval: refuse the sensor's own preference.
+static bool le_param_req(struct bt_conn *conn, struct bt_le_conn_param *param)
+{
+    return false;
+}
+
+BT_CONN_CB_DEFINE(mule_conn_cb) = {
+    .connected = connected,
+    .disconnected = disconnected,
+    .le_param_req = le_param_req,
+};
+
+static bool ad_has_nus(struct bt_data *data, void *user_data)
+{
+    static const uint8_t nus[] = { NUS_UUID_VAL(1) };
+    bool *found = user_data;
+
+    if (data->type == BT_DATA_UUID128_ALL && data->data_len >= sizeof(nus) &&
+        !memcmp(data->data, nus, sizeof(nus))) {
+        *found = true;
+        return false;
+    }
+    return true;
+}
+
+static void on_scan(const bt_addr_le_t *addr, int8_t rssi, uint8_t type,
+                    struct net_buf_simple *ad)
+{
+    struct bt_le_conn_param param = BT_LE_CONN_PARAM_INIT(M.interval, M.interval, 0, 400);
+    bool found = false;
+    int err;
+
+    if (M.conn || type != BT_GAP_ADV_TYPE_ADV_IND) {
+        return;
+    }
+    bt_data_parse(ad, ad_has_nus, &found);
+    if (!found) {
+        return;
+    }
+
+    bt_le_scan_stop();
+    err = bt_conn_le_create(addr, BT_CONN_LE_CREATE_CONN, &param, &M.conn);
+    if (err) {
+        fail("create connection", err);
+    }
+}
+
+int main(void)
+{
+    struct bt_conn_le_phy_param phy = {
+        .pref_tx_phy = M.phy,
+        .pref_rx_phy = M.phy,
+    };
+    struct bt_conn_info info;
+    uint32_t complete_ms;
+    int err;
+
+    k_sem_init(&M.connected, 0, 1);
+    k_sem_init(&M.step, 0, 1);
+    k_sem_init(&M.done, 0, 1);
+
+    err = bt_enable(NULL);
+    if (err) {
+        fail("bt_enable", err);
+    }
+
+    // Let the sensor log fill up: the payload grows with it
+    k_sleep(K_SECONDS(M.settle_s));
+
+    err = bt_le_scan_start(BT_LE_SCAN_PASSIVE, on_scan);
+    if (err) {
+        fail("scan", err);
+    }
+    k_sem_take(&M.connected, K_FOREVER);
+
+    err = bt_conn_le_phy_update(M.conn, &phy);
+    if (err) {
+        fail("PHY update", err);
+    }
+
+    discover(BT_UUID_NUS_RX);
+    discover(BT_UUID_NUS_TX);
+    if (!M.rx_handle || !M.tx_handle) {
+        fail("NUS not found", -ENOENT);
+    }
+
+    M.sub = (struct bt_gatt_subscribe_params){
+        .notify = on_notify,
+        .subscribe = on_subscribed,
+        .value = BT_GATT_CCC_NOTIFY,
+        .value_handle = M.tx_handle,
+        .end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE,
+        .disc_params = &M.ccc_disc,
+    };
+    err = bt_gatt_subscribe(M.conn, &M.sub);
+    if (err) {
+        fail("subscribe", err);
+    }
+    k_sem_take(&M.step, K_FOREVER);
+
+    // Give the sensor's MTU exchange and link tuning time to settle
+    k_sleep(K_SECONDS(2));
+
+    // PREP and STATUS run in order on the sensor: STATUS sees the payload
+    write_cmd(CMD_PREP);
+    write_cmd(CMD_STATUS);
+    k_sem_take(&M.step, K_FOREVER);
+    if (M.len == 0) {
+        fail("no payload", -ENODATA);
+    }
+    if (M.len < M.min_bytes) {
+        printk("MULE_FAIL payload %u bytes, want at least %u\n", M.len, M.min_bytes);
+        posix_exit(1);
+    }
+
+    M.streaming = true;
+    M.t_start = k_uptime_ticks();
+    write_cmd(CMD_START);
+    k_sem_take(&M.done, K_FOREVER);
+    complete_ms = k_ticks_to_ms_ceil32(k_uptime_ticks() - M.t_start);
+
+    (void)bt_conn_get_info(M.conn, &info);
+    printk("MULE_RESULT mtu=%u interval=%u phy=%u bytes=%u ttfb_us=%u complete_ms=%u "
+           "goodput=%u\n",
+           bt_gatt_get_mtu(M.conn), info.le.interval, info.le.phy->tx_phy, M.len,
+           k_ticks_to_us_floor32(M.t_first - M.t_start), complete_ms,
+           complete_ms ? (uint32_t)((uint64_t)M.len * 1000 / complete_ms) : 0);
+
+    posix_exit(0);
+    return 0;
+}
@@ -0,0 +1,130 @@
+#!/usr/bin/env bash
+#
+# BabbleSim end-to-end throughput sweep: the sensor image against the
+# stand-in mule over every combination of
+#   MTU        mule build (compile.sh MULE_MTUS)
+#   interval   connection interval, 1.25 ms units
+#   PHY        1 (1M), 2 (2M), 4 (coded)
+#   settle     seconds of sampling before the mule connects (payload size),
+#              as settle:min_bytes; a shorter payload fails the point
+#   atten      channel attenuation in dB; higher values raise the bit error
+#              rate and so the share of lost packets
+# Each run appends one CSV line
+#   mtu,interval,phy,settle_s,atten_db,bytes,ttfb_us,complete_ms,goodput
+# to the results file (stdout by default).
+#
+# Usage: throughput.sh [-o results.csv] [--save baseline.csv]
+#                      [--check baseline.csv] [--tolerance pct]
+#
+# A point whose link did not use the requested MTU, interval and PHY is
+# left without a result. --check fails when a point's goodput is more than
+# --tolerance percent (default 10) below the baseline, or when a point has
+# no result. Times are simulated, so runs are reproducible on any Linux host.
+#
+set -u
+
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must be set}"
+source "${ZEPHYR_BASE:?ZEPHYR_BASE must be set}/tests/bsim/sh_common.source"
+
+MTUS=${MTUS:-"23 65 247"}
+INTERVALS=${INTERVALS:-"6 24 80"}
+PHYS=${PHYS:-"1 2 4"}
+# tests/bsim/sensor.conf samples every 20 ms: 8 bytes per record, at least
+# 400 bytes per settle second, up to the 2 KB payload buffer
+SETTLES=${SETTLES:-"1:400 3:1200 10:2000"}
+ATTENS=${ATTENS:-"60 85"}
+SIM_LENGTH_S=${SIM_LENGTH_S:-300}
+
+out=/dev/stdout
+save=
+check=
+tolerance=10
+while [ $# -gt 0 ]; do
+    case $1 in
+        -o) out=$2; shift 2 ;;
+        --save) save=$2; shift 2 ;;
+        --check) check=$2; shift 2 ;;
+        --tolerance) tolerance=$2; shift 2 ;;
+        *) echo "unknown argument $1" >&2; exit 2 ;;
+    esac
+done
+
+bin=${BSIM_OUT_PATH}/bin
+results=$(mktemp)
+trap 'rm -f "${results}"' EXIT
+echo "mtu,interval,phy,settle_s,atten_db,bytes,ttfb_us,complete_ms,goodput" > "${results}"
+
+run_point() {
+    local mtu=$1 interval=$2 phy=$3 settle=${4%%:*} atten=$5
+    local min_bytes=0
+    local id="nebula_tp_${mtu}_${interval}_${phy}_${settle}_${atten}"
+    local log=${WORK_DIR:-/tmp}/${id}.log
+    local line
+
+    case $4 in *:*) min_bytes=${4#*:} ;; esac
+
+    cd "${bin}"
+    Execute ./bs_nrf52_bsim_nebula_sensor -v=1 -s="${id}" -d=0 -RealEncryption=1
+    Execute ./bs_nrf52_bsim_nebula_mule_mtu"${mtu}" -v=1 -s="${id}" -d=1 \
+        -RealEncryption=1 -interval="${interval}" -phy="${phy}" -settle_s="${settle}" \
+        -min_bytes="${min_bytes}" > "${log}"
+    Execute ./bs_2G4_phy_v1 -v=1 -s="${id}" -D=2 -sim_length=$((SIM_LENGTH_S * 1000000)) \
+        -argschannel -at="${atten}"
+    wait_for_background_jobs
+
+    line=$(sed -n 's/.*MULE_RESULT //p' "${log}" | tail -n 1)
+    if [ -z "${line}" ]; then
+        echo "${mtu},${interval},${phy},${settle},${atten},,,,"
+        return
+    fi
+    # key=value pairs as r_key
+    eval "$(printf '%s\n' ${line} | sed 's/^/local r_/')"
+    # A link that ended up with other parameters (e.g. no coded PHY, a
+    # smaller MTU) did not measure this point: leave it without a result
+    if [ "${r_mtu}" != "${mtu}" ] || [ "${r_interval}" != "${interval}" ] ||
+       [ "${r_phy}" != "${phy}" ]; then
+        echo "${id}: link used mtu=${r_mtu} interval=${r_interval} phy=${r_phy}," \
+             "point invalid" >&2
+        echo "${mtu},${interval},${phy},${settle},${atten},,,,"
+        return
+    fi
+    echo "${r_mtu},${r_interval},${r_phy},${settle},${atten},${r_bytes},${r_ttfb_us},${r_complete_ms},${r_goodput}"
+}
+
+for mtu in ${MTUS}; do
+    for interval in ${INTERVALS}; do
+        for phy in ${PHYS}; do
+            for settle in ${SETTLES}; do
+                for atten in ${ATTENS}; do
+                    run_point "${mtu}" "${interval}" "${phy}" "${settle}" "${atten}" \
+                        >> "${results}"
+                done
+            done
+        done
+    done
+done
+
+cat "${results}" > "${out}"
+[ -n "${save}" ] && cp "${results}" "${save}"
+
+[ -z "${check}" ] && exit 0
+
+# Compare by sweep point (the first five columns as requested).
+awk -F, -v tol="${tolerance}" '
+    FNR == 1 { next }
+    NR == FNR { base[$1","$2","$3","$4","$5] = $9; next }
+    {
+        key = $1","$2","$3","$4","$5
+        if (!(key in base) || base[key] == "") {
+            next
+        }
+        if ($9 == "") {
+            printf "FAIL %s: no valid result (baseline %s B/s)\n", key, base[key]
+            bad++
+        } else if ($9 * 100 < base[key] * (100 - tol)) {
+            printf "FAIL %s: %s B/s, baseline %s B/s\n", key, $9, base[key]
+            bad++
+        }
+    }
+    END { exit bad ? 1 : 0 }
+' "${check}" "${results}"
@@ -0,0 +1,255 @@
+#!/usr/bin/env python3
+"""Decode Nebula sensor payloads framed by src/compress.c and src/record.c.
+
+Byte 0 of a payload names the codec. Codecs 0-2 start with comp_hdr_t
+(src/data.h):
+    codec:u8 | stride:u8 | raw_len:u32 (little-endian)
+followed by the encoded bytes; see src/compress.c for the formats.
+Codec 3 (CODEC_RECORDS) is a run of fixed-size packets of packed records;
+see rec_pkt_hdr_t in src/data.h.
+
+Payloads sent with CONFIG_SENSOR_ENCRYPT are IV(12) | ciphertext | tag(16)
+(AES-128-GCM unless --alg names the CONFIG_SENSOR_AEAD_* choice); pass
+--key to decrypt them first (needs the 'cryptography' package). With
+CONFIG_SENSOR_ENCRYPT_FRAMED they are a run of frames
+    index:u16 | total:u16 | (frame 0: IV(12)) | ciphertext | tag(8)
+each sealed on its own (see src/aead.h; ChaCha20 tags stay 16 bytes); add
+--frame with CONFIG_SENSOR_AEAD_FRAME_SIZE.
+
+Usage: nebula_codec.py PAYLOAD_FILE [-o RAW_FILE] [--records] [--key HEX [--alg ALG] [--frame N]]
+"""
+import argparse
+import struct
+import sys
+
+CODEC_NONE = 0
+CODEC_LZSS = 1
+CODEC_DELTA_LZSS = 2
+CODEC_RECORDS = 3
+
+HDR = struct.Struct("<BBI")
+PKT_HDR = struct.Struct("<BBII")
+SAMPLE_REC = struct.Struct("<IBBH")   # sample_rec_t, value as stored
+LZ_MIN_MATCH = 3
+
+REC_TYPES = {0: "i16", 1: "u16", 2: "centi", 3: "event"}
+SIGNED_TYPES = (0, 2)
+
+
+def lzss_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        flags = data[i]
+        i += 1
+        for bit in range(8):
+            if i >= len(data):
+                break
+            if flags & (1 << bit):
+                tok = data[i] | data[i + 1] << 8
+                i += 2
+                off = (tok >> 4) + 1
+                n = (tok & 0xF) + LZ_MIN_MATCH
+                if off > len(out):
+                    raise ValueError("match before start of output")
+                for _ in range(n):
+                    out.append(out[-off])
+            else:
+                out.append(data[i])
+                i += 1
+    return bytes(out)
+
+
+def delta_decode(data, stride, raw_len):
+    out = bytearray()
+    prev = [0] * (stride // 2)
+    i = 0
+    while len(out) < raw_len:
+        for lane in range(stride // 2):
+            zz = shift = 0
+            while True:
+                b = data[i]
+                i += 1
+                zz |= (b & 0x7F) << shift
+                shift += 7
+                if not b & 0x80:
+                    break
+            d = (zz >> 1) ^ -(zz & 1)
+            prev[lane] = (prev[lane] + d) & 0xFFFF
+            out += struct.pack("<H", prev[lane])
+    return bytes(out)
+
+
+def _varint(data, i):
+    v = shift = 0
+    while True:
+        b = data[i]
+        i += 1
+        v |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return v, i
+
+
+def _unzigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+def decode_packet(pkt):
+    """Records of one CODEC_RECORDS packet as (seq, t_ms, stream, type, value)."""
+    codec, length, seq, t = PKT_HDR.unpack_from(pkt)
+    if codec != CODEC_RECORDS or length > len(pkt):
+        raise ValueError("not a record packet")
+    recs = []
+    i = PKT_HDR.size
+    while i < length:
+        tag = pkt[i]
+        dt, i = _varint(pkt, i + 1)
+        v, i = _varint(pkt, i)
+        t = (t + _unzigzag(dt)) & 0xFFFFFFFF
+        rtype = tag & 0xF
+        if rtype in SIGNED_TYPES:
+            v = _unzigzag(v)
+        recs.append((seq, t, tag >> 4, rtype, v))
+        seq += 1
+    return recs
+
+
+def decode_records(payload):
+    """Records of a CODEC_RECORDS payload. Packet size is found from the
+    padding: each packet's header sits where the previous one ends."""
+    recs = []
+    i = 0
+    while i < len(payload):
+        _, length, _, _ = PKT_HDR.unpack_from(payload, i)
+        recs += decode_packet(payload[i:i + length])
+        # Skip the zero padding up to the next packet header
+        i += length
+        while i < len(payload) and payload[i] != CODEC_RECORDS:
+            i += 1
+    return recs
+
+
+def records_to_raw(recs):
+    """sample_rec_t bytes as stored in the sensor log"""
+    return b"".join(SAMPLE_REC.pack(t, s, ty, v & 0xFFFF) for _, t, s, ty, v in recs)
+
+
+def raw_to_records(raw, first_seq=0):
+    """(seq, t_ms, stream, type, value) for sample_rec_t bytes"""
+    recs = []
+    for n, (t, s, ty, v) in enumerate(SAMPLE_REC.iter_unpack(raw[:len(raw) // SAMPLE_REC.size * SAMPLE_REC.size])):
+        if ty in SIGNED_TYPES and v > 0x7FFF:
+            v -= 0x10000
+        recs.append((first_seq + n, t, s, ty, v))
+    return recs
+
+
+def decode(payload):
+    """Return (codec, stride, raw bytes) for one framed payload."""
+    if payload[0] == CODEC_RECORDS:
+        return CODEC_RECORDS, SAMPLE_REC.size, records_to_raw(decode_records(payload))
+
+    codec, stride, raw_len = HDR.unpack_from(payload)
+    body = payload[HDR.size:]
+    if codec == CODEC_NONE:
+        raw = body
+    elif codec == CODEC_LZSS:
+        raw = lzss_decode(body)
+    elif codec == CODEC_DELTA_LZSS:
+        raw = delta_decode(lzss_decode(body), stride, raw_len)
+    else:
+        raise ValueError("unknown codec %d" % codec)
+    if len(raw) != raw_len:
+        raise ValueError("decoded %d bytes, header says %d" % (len(raw), raw_len))
+    return codec, stride, raw
+
+
+IV_SIZE = 12
+TAG_SIZE = 16
+ALGS = ("gcm", "ccm", "chacha20-poly1305")
+
+
+def aead_open(alg, key, nonce, ad, ct, tag):
+    """Decrypt and authenticate with CONFIG_SENSOR_AEAD_*; raises if the tag fails."""
+    if alg == "gcm":
+        from cryptography.hazmat.primitives.ciphers import Cipher, algorithms, modes
+        dec = Cipher(algorithms.AES(key), modes.GCM(nonce, tag, min_tag_length=len(tag))).decryptor()
+        if ad:
+            dec.authenticate_additional_data(ad)
+        return dec.update(ct) + dec.finalize()
+    if alg == "ccm":
+        from cryptography.hazmat.primitives.ciphers.aead import AESCCM
+        return AESCCM(key, tag_length=len(tag)).decrypt(nonce, ct + tag, ad or None)
+    from cryptography.hazmat.primitives.ciphers.aead import ChaCha20Poly1305
+    return ChaCha20Poly1305(key).decrypt(nonce, ct + tag, ad or None)
+
+
+def decrypt(payload, key, alg="gcm"):
+    """Plaintext of an IV | ciphertext | tag payload; raises if the tag fails."""
+    return aead_open(alg, key, payload[:IV_SIZE], b"", payload[IV_SIZE:-TAG_SIZE],
+                     payload[-TAG_SIZE:])
+
+
+SEG_HDR = struct.Struct("<HH")
+
+
+def decrypt_frames(payload, key, frame, alg="gcm"):
+    """Plaintext of a framed payload; raises on a bad, missing or misplaced frame."""
+    # Poly1305 tags cannot be truncated
+    tag_size = TAG_SIZE if alg == "chacha20-poly1305" else 8
+    out = bytearray()
+    iv = payload[SEG_HDR.size:SEG_HDR.size + IV_SIZE]
+    total = SEG_HDR.unpack_from(payload)[1]
+    pos = 0
+    for i in range(total):
+        seg = payload[pos:pos + frame]
+        index, seg_total = SEG_HDR.unpack_from(seg)
+        if index != i or seg_total != total:
+            raise ValueError("frame %d at offset %d says %d of %d" % (i, pos, index, seg_total))
+        ad_len = SEG_HDR.size + (IV_SIZE if i == 0 else 0)
+        # Frame i's nonce: the IV with i added to its big-endian counter
+        ctr = int.from_bytes(iv[4:], "big") + i
+        nonce = iv[:4] + (ctr % (1 << 64)).to_bytes(8, "big")
+        out += aead_open(alg, key, nonce, seg[:ad_len], seg[ad_len:-tag_size], seg[-tag_size:])
+        pos += len(seg)
+    if pos != len(payload):
+        raise ValueError("%d bytes after the last frame" % (len(payload) - pos))
+    return bytes(out)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("payload")
+    ap.add_argument("-o", "--output", help="write the raw bytes here")
+    ap.add_argument("--records", action="store_true",
+                    help="print sample_rec_t records as CSV (seq,t_ms,stream,type,value)")
+    ap.add_argument("--key", type=bytes.fromhex,
+                    help="key (hex) of an encrypted payload: 16 bytes, 32 for ChaCha20")
+    ap.add_argument("--alg", choices=ALGS, default="gcm",
+                    help="payload AEAD (CONFIG_SENSOR_AEAD_*)")
+    ap.add_argument("--frame", type=int,
+                    help="AEAD frame size of a framed payload (CONFIG_SENSOR_AEAD_FRAME_SIZE)")
+    args = ap.parse_args()
+
+    with open(args.payload, "rb") as f:
+        payload = f.read()
+    if args.key and args.frame:
+        payload = decrypt_frames(payload, args.key, args.frame, args.alg)
+    elif args.key:
+        payload = decrypt(payload, args.key, args.alg)
+    codec, stride, raw = decode(payload)
+    print("codec %d, stride %d: %d -> %d bytes (%.2f:1)"
+          % (codec, stride, len(payload), len(raw), len(raw) / max(len(payload), 1)),
+          file=sys.stderr)
+    if args.output:
+        with open(args.output, "wb") as f:
+            f.write(raw)
+    if args.records:
+        first_seq = PKT_HDR.unpack_from(payload)[2] if codec == CODEC_RECORDS else 0
+        for seq, t, s, ty, v in raw_to_records(raw, first_seq):
+            print("%d,%d,%d,%s,%d" % (seq, t, s, REC_TYPES.get(ty, ty), v))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""Capture and decode the sensor's dictionary log (prj_dictlog.conf).
+
+With the dictionary profile the sensor writes binary log messages on the
+UART: a format string id and the raw arguments. The strings live in the
+build's zephyr/log_dictionary.json, which must come from the very build
+that is running on the device.
+
+    nebula_log.py capture --port /dev/ttyACM0 [--baud 115200] [--seconds N] OUT
+        save the raw UART stream to OUT (until Ctrl-C or N seconds;
+        needs the 'pyserial' package)
+    nebula_log.py decode [--build-dir build | --dict FILE] [--hex] [-o TEXT] CAPTURE
+        decode CAPTURE with Zephyr's scripts/logging/dictionary/log_parser.py
+        (ZEPHYR_BASE must be set); --hex for captures made with
+        CONFIG_LOG_BACKEND_UART_OUTPUT_DICTIONARY_HEX
+
+The decoded text has the same messages as a text build, so trace dumps in
+it can be passed on to nebula_trace.py.
+"""
+import argparse
+import os
+import subprocess
+import sys
+import time
+
+# Sysbuild images that are not the application
+OTHER_IMAGES = ("mcuboot", "b0", "b0n", "ipc_radio", "hci_ipc")
+
+
+def find_dictionary(build_dir):
+    """zephyr/log_dictionary.json of the application image in build_dir."""
+    found = []
+    for root, dirs, files in os.walk(build_dir):
+        if "log_dictionary.json" in files and os.path.basename(root) == "zephyr":
+            found.append(os.path.join(root, "log_dictionary.json"))
+    apps = [f for f in found
+            if os.path.basename(os.path.dirname(os.path.dirname(f))) not in OTHER_IMAGES]
+    if len(apps) != 1:
+        raise SystemExit("%s: expected one application log_dictionary.json, found %s"
+                         % (build_dir, apps or "none"))
+    return apps[0]
+
+
+def capture(args):
+    try:
+        import serial
+    except ImportError:
+        raise SystemExit("capture needs pyserial (pip install pyserial)")
+
+    end = time.monotonic() + args.seconds if args.seconds else None
+    n = 0
+    with serial.Serial(args.port, args.baud, timeout=0.2) as port, open(args.out, "wb") as out:
+        try:
+            while end is None or time.monotonic() < end:
+                data = port.read(4096)
+                if data:
+                    out.write(data)
+                    n += len(data)
+        except KeyboardInterrupt:
+            pass
+    print("%d bytes saved to %s" % (n, args.out), file=sys.stderr)
+    return 0
+
+
+def decode(args):
+    zephyr = os.environ.get("ZEPHYR_BASE")
+    if not zephyr:
+        raise SystemExit("ZEPHYR_BASE must point at the Zephyr tree of the build")
+    parser = os.path.join(zephyr, "scripts", "logging", "dictionary", "log_parser.py")
+    if not os.path.isfile(parser):
+        raise SystemExit("%s not found; is ZEPHYR_BASE right?" % parser)
+    db = args.dict or find_dictionary(args.build_dir)
+
+    cmd = [sys.executable, parser]
+    if args.hex:
+        cmd.append("--hex")
+    cmd += [db, args.capture]
+    if not args.output:
+        return subprocess.call(cmd)
+    with open(args.output, "w") as out:
+        return subprocess.call(cmd, stdout=out)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    sub = ap.add_subparsers(dest="action", required=True)
+
+    cap = sub.add_parser("capture", help="save the raw UART stream")
+    cap.add_argument("--port", required=True, help="serial port of the log UART")
+    cap.add_argument("--baud", type=int, default=115200)
+    cap.add_argument("--seconds", type=float, help="stop after this long")
+    cap.add_argument("out", help="file for the raw stream")
+
+    dec = sub.add_parser("decode", help="decode a raw capture")
+    src = dec.add_mutually_exclusive_group()
+    src.add_argument("--build-dir", default="build", help="build directory (default build)")
+    src.add_argument("--dict", help="log_dictionary.json to use")
+    dec.add_argument("--hex", action="store_true", help="capture is hex text")
+    dec.add_argument("-o", "--output", help="write the decoded text here")
+    dec.add_argument("capture", help="raw capture file")
+
+    args = ap.parse_args()
+    return capture(args) if args.action == "capture" else decode(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+"""Decode the hot-path trace ring printed by the sensor (src/trace.c).
+
+Capture the console while sending TRACE (or running "trace dump" on the
+shell) and pass the capture here. Lines outside the dump are ignored, so a
+full log works; with several dumps the last one is used. The dump is
+
+    # trace v1 hz=<cycles per second> n=<records> lost=<overwritten>
+    T <cyc:8 hex> <ev:2 hex> <id:2 hex> <arg:4 hex>
+    # trace end
+
+Prints a timeline (time since the first record, connection, event,
+argument, and the duration of each stage at its end) and, per stage, a
+latency histogram with power-of-two microsecond buckets. Stages are the
+begin/end pairs of enum trace_ev in src/trace.h. The 32-bit cycle counter
+wraps (every 67 s at 64 MHz), so consecutive records must be closer than
+that; they always are unless the ring sat idle for a long time.
+
+Usage: nebula_trace.py CAPTURE [--no-timeline] [--no-hist] [--csv FILE]
+"""
+import argparse
+import re
+import sys
+
+TRACE_END = 0x80
+NO_ID = 0xFF
+
+# enum trace_ev; True for begin/end stages
+EVENTS = {
+    1: ("tx_work", True),
+    2: ("send", True),      # begin: chunk length in bytes; end: result
+    3: ("seal", True),
+    4: ("cmd", True),
+    5: ("prep", True),
+    6: ("tx_done", False),
+    7: ("conn", False),
+    8: ("disconn", False),
+}
+
+HDR_RE = re.compile(r"# trace v1 hz=(\d+) n=(\d+) lost=(\d+)")
+REC_RE = re.compile(r"\bT ([0-9a-f]{8}) ([0-9a-f]{2}) ([0-9a-f]{2}) ([0-9a-f]{4})\b")
+
+
+def parse(lines):
+    """Return (hz, lost, [(cyc, ev, id, arg)]) of the last dump."""
+    dump = None
+    for line in lines:
+        m = HDR_RE.search(line)
+        if m:
+            dump = (int(m.group(1)), int(m.group(3)), [])
+            continue
+        if dump is None:
+            continue
+        if "# trace end" in line:
+            continue
+        m = REC_RE.search(line)
+        if m:
+            dump[2].append(tuple(int(g, 16) for g in m.groups()))
+    if dump is None:
+        raise ValueError("no trace dump found")
+    return dump
+
+
+def unwrap(recs):
+    """Cycle stamps as a monotonic count from the first record."""
+    t = 0
+    prev = recs[0][0] if recs else 0
+    for cyc, ev, cid, arg in recs:
+        t += (cyc - prev) & 0xFFFFFFFF
+        prev = cyc
+        yield t, ev, cid, arg
+
+
+def event_name(ev):
+    name, _ = EVENTS.get(ev & ~TRACE_END, ("ev%d" % (ev & ~TRACE_END), False))
+    return name
+
+
+def fmt_arg(ev, arg):
+    code = ev & ~TRACE_END
+    if code == 2:
+        # send: length in bytes at the begin, negative errno at the end
+        if ev & TRACE_END:
+            return str(arg - 0x10000 if arg & 0x8000 else arg)
+        return "%d B" % arg
+    if code == 4:
+        return "0x%02x" % arg
+    return str(arg)
+
+
+def analyse(hz, recs, timeline, out=sys.stdout):
+    """Pair stage begins with ends; print the timeline, return durations."""
+    open_stages = {}
+    durations = {}
+    for t, ev, cid, arg in unwrap(recs):
+        us = t * 1e6 / hz
+        code = ev & ~TRACE_END
+        name = event_name(ev)
+        is_stage = EVENTS.get(code, ("", False))[1]
+        who = "-" if cid == NO_ID else str(cid)
+        extra = ""
+        if is_stage and not ev & TRACE_END:
+            open_stages.setdefault((code, cid), []).append(us)
+            kind = "begin"
+        elif is_stage:
+            starts = open_stages.get((code, cid))
+            kind = "end"
+            if starts:
+                d = us - starts.pop()
+                durations.setdefault(name, []).append(d)
+                extra = "  (%.1f us)" % d
+        else:
+            kind = "mark"
+        if timeline:
+            print("%12.1f us  [%s] %-8s %-5s %s%s" % (us, who, name, kind,
+                                                   fmt_arg(ev, arg), extra), file=out)
+    return durations
+
+
+def percentile(sorted_vals, p):
+    i = min(len(sorted_vals) - 1, int(round(p / 100.0 * (len(sorted_vals) - 1))))
+    return sorted_vals[i]
+
+
+def histogram(name, vals, out=sys.stdout):
+    vals = sorted(vals)
+    print("\n%s: n=%d min=%.1f p50=%.1f p90=%.1f p99=%.1f max=%.1f us" % (
+        name, len(vals), vals[0], percentile(vals, 50), percentile(vals, 90),
+        percentile(vals, 99), vals[-1]), file=out)
+    buckets = {}
+    for v in vals:
+        b = 0
+        while (1 << b) < v:
+            b += 1
+        buckets[b] = buckets.get(b, 0) + 1
+    peak = max(buckets.values())
+    for b in range(min(buckets), max(buckets) + 1):
+        n = buckets.get(b, 0)
+        lo = 0 if b == 0 else 1 << (b - 1)
+        print("  %7d..%-7d us %6d %s" % (lo, 1 << b, n, "#" * (40 * n // peak)), file=out)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("capture", help="console capture holding a trace dump")
+    ap.add_argument("--no-timeline", action="store_true", help="skip the timeline")
+    ap.add_argument("--no-hist", action="store_true", help="skip the histograms")
+    ap.add_argument("--csv", help="write stage,duration_us lines here")
+    args = ap.parse_args()
+
+    with open(args.capture, errors="replace") as f:
+        hz, lost, recs = parse(f)
+    if not recs:
+        print("trace is empty")
+        return 0
+    print("# %d records at %d Hz, %d older ones overwritten" % (len(recs), hz, lost))
+
+    durations = analyse(hz, recs, not args.no_timeline)
+    if not args.no_hist:
+        for name in sorted(durations):
+            histogram(name, durations[name])
+    if args.csv:
+        with open(args.csv, "w") as f:
+            f.write("stage,duration_us\n")
+            for name in sorted(durations):
+                for d in durations[name]:
+                    f.write("%s,%.2f\n" % (name, d))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())